@@ -0,0 +1,114 @@
+
+// Compares importance sampling of a latitude-longitude environment map with alias tables
+// (Samplers::Sphere::Image_Alias) against the usual marginal/conditional CDFs searched with
+// std::upper_bound.
+//
+// Usage: bench_env_sampling [width] [height] [samples]
+
+#include "../rays/alias_table.h"
+#include "../util/rand.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds_since(Clock::time_point begin) {
+    return std::chrono::duration<double>(Clock::now() - begin).count();
+}
+
+// Reference: marginal CDF over rows and one conditional CDF per row, weighted the same way
+struct Image_CDF {
+
+    Image_CDF(const std::vector<float>& luma, size_t w, size_t h) : w(w), h(h) {
+        conditional.resize(w * h);
+        marginal.resize(h);
+        float total = 0.0f;
+        for(size_t y = 0; y < h; y++) {
+            float s = std::sin(PI_F * (1.0f - ((float)y + 0.5f) / h)), sum = 0.0f;
+            for(size_t x = 0; x < w; x++) {
+                sum += luma[y * w + x] * s;
+                conditional[y * w + x] = sum;
+            }
+            for(size_t x = 0; x < w; x++) conditional[y * w + x] /= std::max(sum, FLT_MIN);
+            total += sum;
+            marginal[y] = total;
+        }
+        for(float& m : marginal) m /= total;
+    }
+
+    Vec3 sample() const {
+        Vec2 xi = RNG::unit2();
+        size_t y = std::upper_bound(marginal.begin(), marginal.end(), xi.y) - marginal.begin();
+        y = std::min(y, h - 1);
+        auto row = conditional.begin() + y * w;
+        size_t x = std::upper_bound(row, row + w, xi.x) - row;
+        x = std::min(x, w - 1);
+
+        float phi = 2.0f * PI_F * ((float)x + RNG::unit()) / w;
+        float theta = PI_F * (1.0f - ((float)y + RNG::unit()) / h);
+        float sin_t = std::sin(theta);
+        return Vec3(sin_t * std::cos(phi), std::cos(theta), sin_t * std::sin(phi));
+    }
+
+    size_t w, h;
+    std::vector<float> marginal, conditional;
+};
+
+int main(int argc, char** argv) {
+
+    size_t w = argc > 1 ? std::atoi(argv[1]) : 8192;
+    size_t h = argc > 2 ? std::atoi(argv[2]) : 4096;
+    size_t n = argc > 3 ? std::atoi(argv[3]) : 10000000;
+    RNG::seed(1, 0, 0);
+
+    // A dim sky gradient with a small, very bright sun: the hard case for importance sampling
+    std::vector<float> luma(w * h);
+    for(size_t y = 0; y < h; y++) {
+        for(size_t x = 0; x < w; x++) {
+            float dx = (float)x / w - 0.3f, dy = (float)y / h - 0.7f;
+            float sun = dx * dx + dy * dy < 1e-4f ? 5000.0f : 0.0f;
+            luma[y * w + x] = 0.2f + 0.8f * (float)y / h + sun + 0.1f * RNG::unit();
+        }
+    }
+    std::printf("%zu x %zu map, %zu samples\n\n", w, h, n);
+
+    Thread_Pool pool(std::max(1u, std::thread::hardware_concurrency()));
+
+    auto begin = Clock::now();
+    Image_CDF cdf(luma, w, h);
+    std::printf("CDF build:              %8.3f s\n", seconds_since(begin));
+
+    begin = Clock::now();
+    Samplers::Sphere::Image_Alias serial(luma, w, h);
+    std::printf("Alias build (serial):   %8.3f s\n", seconds_since(begin));
+
+    begin = Clock::now();
+    Samplers::Sphere::Image_Alias alias(luma, w, h, &pool);
+    std::printf("Alias build (parallel): %8.3f s\n\n", seconds_since(begin));
+
+    // Sum the directions so the compiler can't drop the work
+    Vec3 sum;
+    begin = Clock::now();
+    for(size_t i = 0; i < n; i++) sum += cdf.sample();
+    double t_cdf = seconds_since(begin);
+
+    begin = Clock::now();
+    for(size_t i = 0; i < n; i++) sum += alias.sample();
+    double t_alias = seconds_since(begin);
+
+    // E[1 / pdf] over samples is the measure of the support, 4pi, if sample and pdf agree
+    double inv_pdf = 0.0;
+    begin = Clock::now();
+    for(size_t i = 0; i < n; i++) inv_pdf += 1.0 / alias.pdf(alias.sample());
+    double t_both = seconds_since(begin);
+
+    std::printf("CDF sample:   %8.2f ns\n", 1e9 * t_cdf / n);
+    std::printf("Alias sample: %8.2f ns (%.2fx)\n", 1e9 * t_alias / n, t_cdf / t_alias);
+    std::printf("Alias pdf:    %8.2f ns\n", 1e9 * (t_both - t_alias) / n);
+    std::printf("\nE[1/pdf] = %.4f (expected %.4f), checksum %f\n", inv_pdf / n, 4.0 * PI_F,
+                sum.x + sum.y + sum.z);
+    return 0;
+}
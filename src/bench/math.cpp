@@ -0,0 +1,113 @@
+
+// Times the Mat4 kernels used when tracing rays through transformed objects: products,
+// point and direction transforms, transposes, inverses and Ray::transform. Built twice,
+// as bench_math (with SCOTTY3D_SIMD_MATH, if enabled) and bench_math_scalar (without),
+// so the two implementations can be compared on the same machine.
+//
+// Usage: bench_math [matrices] [repeats]
+
+#include "../lib/mathlib.h"
+#include "../util/rand.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds_since(Clock::time_point begin) {
+    return std::chrono::duration<double>(Clock::now() - begin).count();
+}
+
+static Vec3 random_vec(float scale) {
+    return Vec3(RNG::unit() - 0.5f, RNG::unit() - 0.5f, RNG::unit() - 0.5f) * (2.0f * scale);
+}
+
+int main(int argc, char** argv) {
+
+    size_t n = argc > 1 ? std::atoi(argv[1]) : 4096;
+    size_t repeats = argc > 2 ? std::atoi(argv[2]) : 2000;
+    RNG::seed(1, 0, 0);
+
+#ifdef SCOTTY3D_MAT4_SSE
+    std::printf("Mat4 kernels: SSE\n");
+#else
+    std::printf("Mat4 kernels: scalar\n");
+#endif
+    std::printf("%zu matrices, %zu repeats\n\n", n, repeats);
+
+    // Object transforms: rotation, non-uniform scale and translation
+    std::vector<Mat4> mats(n);
+    std::vector<Vec3> points(n);
+    std::vector<Ray> rays(n);
+    for(size_t i = 0; i < n; i++) {
+        Vec3 scale(0.5f + RNG::unit(), 0.5f + RNG::unit(), 0.5f + RNG::unit());
+        mats[i] = Mat4::translate(random_vec(10.0f)) * Mat4::euler(random_vec(180.0f)) *
+                  Mat4::scale(scale);
+        points[i] = random_vec(10.0f);
+        rays[i] = Ray(points[i], random_vec(1.0f));
+    }
+
+    // Accumulate every result so the compiler can't drop the work
+    float sum = 0.0f;
+    size_t ops = n * repeats;
+    auto report = [&](const char* name, double seconds) {
+        std::printf("%-16s %8.2f ns\n", name, 1e9 * seconds / ops);
+    };
+
+    auto begin = Clock::now();
+    for(size_t r = 0; r < repeats; r++) {
+        for(size_t i = 0; i < n; i++) sum += (mats[i] * mats[(i + r) % n]).data[(i + r) % 16];
+    }
+    report("Mat4 * Mat4", seconds_since(begin));
+
+    begin = Clock::now();
+    for(size_t r = 0; r < repeats; r++) {
+        Vec3 acc;
+        for(size_t i = 0; i < n; i++) acc += mats[i] * points[i];
+        sum += acc.x;
+    }
+    report("Mat4 * Vec3", seconds_since(begin));
+
+    begin = Clock::now();
+    for(size_t r = 0; r < repeats; r++) {
+        Vec3 acc;
+        for(size_t i = 0; i < n; i++) acc += mats[i].rotate(points[i]);
+        sum += acc.y;
+    }
+    report("Mat4::rotate", seconds_since(begin));
+
+    begin = Clock::now();
+    for(size_t r = 0; r < repeats; r++) {
+        for(size_t i = 0; i < n; i++) sum += mats[i].T().data[(i + r) % 16];
+    }
+    report("Mat4::T", seconds_since(begin));
+
+    begin = Clock::now();
+    for(size_t r = 0; r < repeats; r++) {
+        for(size_t i = 0; i < n; i++) sum += mats[i].inverse().data[(i + r) % 16];
+    }
+    report("Mat4::inverse", seconds_since(begin));
+
+    begin = Clock::now();
+    for(size_t r = 0; r < repeats; r++) {
+        for(size_t i = 0; i < n; i++) {
+            Ray ray = rays[i];
+            ray.transform(mats[i]);
+            sum += ray.dir.z;
+        }
+    }
+    report("Ray::transform", seconds_since(begin));
+
+    // Both implementations must agree with the identity to float precision
+    float error = 0.0f;
+    for(size_t i = 0; i < n; i++) {
+        Mat4 id = mats[i] * mats[i].inverse();
+        for(int j = 0; j < 16; j++) {
+            error = std::max(error, std::abs(id.data[j] - Mat4::I.data[j]));
+        }
+    }
+    std::printf("\nmax |M M^-1 - I| = %g, checksum %f\n", error, sum);
+    return 0;
+}
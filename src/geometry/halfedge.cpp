@@ -6,7 +6,7 @@
 #include <sstream>
 #include <unordered_map>
 
-#include "../gui/widgets.h"
+#include "../gui/widget_ids.h"
 
 Halfedge_Mesh::Halfedge_Mesh() {
     next_id = Gui::n_Widget_IDs;
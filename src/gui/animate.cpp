@@ -677,6 +677,10 @@ void Animate::step_sim(Scene& scene) {
     simulate.step(scene, 1.0f / frame_rate);
 }
 
+void Animate::clear_sim(Scene& scene) {
+    simulate.clear_particles(scene);
+}
+
 Camera Animate::set_time(Scene& scene, float time) {
 
     current_frame = (int)time;
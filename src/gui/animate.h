@@ -50,6 +50,9 @@ public:
     void refresh(Scene& scene);
     void load_cam(Vec3 pos, Vec3 front, float ar, float fov, float ap, float dist);
     void step_sim(Scene& scene);
+    /// Return the simulation to its state before the first step, so it can be replayed
+    /// from the start
+    void clear_sim(Scene& scene);
 
     std::string pump_output(Scene& scene);
     Camera set_time(Scene& scene, float time);
@@ -0,0 +1,309 @@
+
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "animate.h"
+#include "widgets.h"
+
+#include "../app.h"
+#include "../platform/socket.h"
+#include "../util/frame_writer.h"
+
+// Distributed headless rendering. A coordinator listens on a TCP port; workers, started
+// with the same scene, connect and receive the coordinator's render settings, then
+// repeatedly take a job (a tile of the frame, or a whole animation frame), trace it with
+// their Pathtracer and send back the linear radiance. Jobs held by a worker that
+// disconnects go back to the queue, so workers may join or leave at any time.
+//
+// Messages are fixed-size records of native-endian 32-bit fields, so every machine
+// involved must share byte order (as all common targets do).
+
+namespace Gui {
+
+static constexpr uint32_t protocol_magic = 0x53334452; // "S3DR"
+static constexpr uint32_t protocol_version = 1;
+
+enum class Message : uint32_t { setup, job, result, done };
+
+struct Setup {
+    uint32_t magic = protocol_magic, version = protocol_version;
+    uint32_t w = 0, h = 0, samples = 0, depth = 0, seed = 0;
+    uint32_t independent = 0, no_bvh = 0;
+    // Number of animation frames, or zero when rendering a single frame
+    uint32_t frames = 0;
+};
+
+// The region [x0,x1) x [y0,y1) of a frame. Results send the job back, followed by its
+// pixels as rows of RGB floats from y0 up.
+struct Job {
+    uint32_t frame = 0;
+    uint32_t x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+    size_t floats() const {
+        return (size_t)(x1 - x0) * (y1 - y0) * 3;
+    }
+};
+
+template<typename T> static bool send_message(Socket& socket, Message type, const T& body) {
+    return socket.send(&type, sizeof(type)) && socket.send(&body, sizeof(body));
+}
+
+static bool send_message(Socket& socket, Message type) {
+    return socket.send(&type, sizeof(type));
+}
+
+template<typename T> static bool recv_body(Socket& socket, T& body) {
+    return socket.recv(&body, sizeof(body));
+}
+
+static bool parse_address(const std::string& address, std::string& host, uint16_t& port) {
+    size_t colon = address.rfind(':');
+    if(colon == std::string::npos || colon == 0) return false;
+    host = address.substr(0, colon);
+    int p = std::atoi(address.c_str() + colon + 1);
+    if(p <= 0 || p > 65535) return false;
+    port = (uint16_t)p;
+    return true;
+}
+
+std::string Widget_Render::coordinate(Animate& animate, const Launch_Settings& set) {
+
+    if(set.adapt_err > 0.0f) return "Distributed renders don't support adaptive sampling.";
+    if(set.resume) return "Distributed renders don't support --resume.";
+    if(set.coordinator > 65535) return "Invalid coordinator port.";
+
+    Setup setup;
+    setup.w = (uint32_t)set.w;
+    setup.h = (uint32_t)set.h;
+    setup.samples = (uint32_t)set.s;
+    setup.depth = (uint32_t)set.d;
+    setup.seed = set.seed;
+    setup.independent = set.independent;
+    setup.no_bvh = set.no_bvh;
+    setup.frames = set.animate ? (uint32_t)animate.n_frames() : 0;
+
+    // Animations are split by frame. Single frames are split into square tiles, several
+    // per worker, so faster workers take more of them.
+    std::deque<Job> pending;
+    if(set.animate) {
+        for(uint32_t f = 0; f < setup.frames; f++) pending.push_back({f, 0, 0, setup.w, setup.h});
+    } else {
+        constexpr uint32_t job_size = 128;
+        for(uint32_t y = 0; y < setup.h; y += job_size) {
+            for(uint32_t x = 0; x < setup.w; x += job_size) {
+                pending.push_back({0, x, y, std::min(x + job_size, setup.w),
+                                   std::min(y + job_size, setup.h)});
+            }
+        }
+    }
+
+    Socket server;
+    std::string err = server.listen((uint16_t)set.coordinator);
+    if(!err.empty()) return err;
+    info("Waiting for workers on port %d; %zu jobs", set.coordinator, pending.size());
+
+    HDR_Image image(setup.w, setup.h);
+    Frame_Writer writer(set.exp, 2);
+
+    std::mutex mut;
+    std::condition_variable cv;
+    size_t total = pending.size(), remaining = total;
+    std::string error;
+
+    // Each worker gets its own connection thread, which feeds it jobs until none remain
+    auto serve = [&](Socket conn, size_t id) {
+        if(!send_message(conn, Message::setup, setup)) return;
+
+        std::vector<float> pixels;
+        while(true) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mut);
+                // Wait while other workers hold the last jobs, in case they fail
+                cv.wait(lock, [&]() { return !pending.empty() || !remaining || !error.empty(); });
+                if(pending.empty() || !error.empty()) break;
+                job = pending.front();
+                pending.pop_front();
+            }
+
+            Message type;
+            Job done;
+            bool ok = send_message(conn, Message::job, job) && recv_body(conn, type) &&
+                      type == Message::result && recv_body(conn, done) &&
+                      std::memcmp(&done, &job, sizeof(Job)) == 0;
+            if(ok) {
+                pixels.resize(job.floats());
+                ok = conn.recv(pixels.data(), pixels.size() * sizeof(float));
+            }
+            if(!ok) {
+                warn("Worker %zu failed; returning its job to the queue.", id);
+                std::lock_guard<std::mutex> lock(mut);
+                pending.push_front(job);
+                cv.notify_all();
+                return;
+            }
+
+            size_t w = job.x1 - job.x0;
+            auto copy_to = [&](HDR_Image& dst) {
+                for(uint32_t y = job.y0; y < job.y1; y++) {
+                    Spectrum* row = dst.row(y);
+                    const float* src = pixels.data() + (size_t)(y - job.y0) * w * 3;
+                    for(size_t x = 0; x < w; x++) {
+                        row[job.x0 + x] = Spectrum(src[3 * x], src[3 * x + 1], src[3 * x + 2]);
+                    }
+                }
+            };
+
+            std::string write_err;
+            if(set.animate) {
+                HDR_Image frame(setup.w, setup.h);
+                copy_to(frame);
+                std::string path =
+                    Headless::frame_path(set.output_file, (int)job.frame, set.frame_format);
+                write_err = writer.push(std::move(frame), path);
+            } else {
+                std::lock_guard<std::mutex> lock(mut);
+                copy_to(image);
+            }
+
+            std::lock_guard<std::mutex> lock(mut);
+            if(!write_err.empty() && error.empty()) error = write_err;
+            remaining--;
+            cv.notify_all();
+        }
+        send_message(conn, Message::done);
+    };
+
+    std::vector<std::thread> connections;
+    while(true) {
+        {
+            std::lock_guard<std::mutex> lock(mut);
+            if(!remaining || !error.empty()) break;
+            float done = (float)(total - remaining) / total;
+            std::cout << "Progress: " << std::fixed << std::setprecision(2) << 100.0f * done
+                      << "% (" << connections.size() << " workers)\r" << std::flush;
+        }
+        Socket conn = server.accept(250);
+        if(conn.valid()) {
+            connections.emplace_back(serve, std::move(conn), connections.size());
+        }
+    }
+    server.close();
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        cv.notify_all();
+    }
+    for(std::thread& t : connections) t.join();
+    std::cout << std::endl;
+
+    if(!error.empty()) return error;
+    if(!set.animate) {
+        err = writer.push(std::move(image), set.output_file);
+        if(!err.empty()) return err;
+    }
+    return writer.finish();
+}
+
+std::string Widget_Render::work(Animate& animate, Scene& scene, const Camera& cam,
+                                const Launch_Settings& set) {
+
+    std::string host;
+    uint16_t port = 0;
+    if(!parse_address(set.worker, host, port)) return "Expected --worker host:port.";
+
+    // Workers may start before their coordinator, so keep trying for a while
+    Socket conn;
+    std::string err;
+    for(int attempt = 0; attempt < 120; attempt++) {
+        err = conn.connect(host, port);
+        if(err.empty()) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    }
+    if(!err.empty()) return err;
+
+    Message type;
+    Setup setup;
+    if(!recv_body(conn, type) || type != Message::setup || !recv_body(conn, setup)) {
+        return "Failed to receive settings from the coordinator.";
+    }
+    if(setup.magic != protocol_magic || setup.version != protocol_version) {
+        return "The coordinator speaks a different protocol version.";
+    }
+    info("Working for %s: %ux%u, %u samples, depth %u", set.worker.c_str(), setup.w, setup.h,
+         setup.samples, setup.depth);
+
+    out_w = (int)setup.w;
+    out_h = (int)setup.h;
+    pathtracer.set_params(setup.w, setup.h, setup.samples, setup.depth, !setup.no_bvh);
+    pathtracer.set_adaptive(0.0f, 0);
+    pathtracer.set_seed(setup.seed);
+    pathtracer.set_sequence(setup.independent ? RNG::Sequence::independent
+                                              : RNG::Sequence::sobol);
+
+    // The scene is built once per frame and shared by every job of that frame. Animation
+    // frames are evaluated in order; if an earlier frame is requeued from another worker,
+    // the simulation is replayed from the start.
+    int built = -1, evaluated = -1;
+    Camera frame_cam = cam;
+    std::vector<float> pixels;
+    size_t jobs = 0;
+
+    while(true) {
+
+        Job job;
+        if(!recv_body(conn, type)) return "Lost the connection to the coordinator.";
+        if(type == Message::done) break;
+        if(type != Message::job || !recv_body(conn, job)) return "Unexpected message.";
+        if(job.x1 > setup.w || job.y1 > setup.h || job.x0 >= job.x1 || job.y0 >= job.y1) {
+            return "Invalid job.";
+        }
+
+        int frame = (int)job.frame;
+        if(frame != built) {
+            if(setup.frames > 0) {
+                if(frame < evaluated) {
+                    animate.clear_sim(scene);
+                    evaluated = -1;
+                }
+                while(evaluated < frame) {
+                    frame_cam = evaluate_frame(animate, scene, ++evaluated, setup.seed);
+                }
+            }
+            pathtracer.prebuild(scene);
+            built = frame;
+        }
+
+        pathtracer.set_region({job.x0, job.y0, job.x1, job.y1});
+        pathtracer.begin_render(scene, frame_cam);
+        while(!pathtracer.wait(std::chrono::seconds(1))) {
+        }
+
+        const HDR_Image& out = pathtracer.get_output();
+        size_t w = job.x1 - job.x0;
+        pixels.resize(job.floats());
+        for(uint32_t y = job.y0; y < job.y1; y++) {
+            const Spectrum* row = out.row(y) + job.x0;
+            float* dst = pixels.data() + (size_t)(y - job.y0) * w * 3;
+            for(size_t x = 0; x < w; x++) {
+                dst[3 * x] = row[x].r;
+                dst[3 * x + 1] = row[x].g;
+                dst[3 * x + 2] = row[x].b;
+            }
+        }
+        if(!send_message(conn, Message::result, job) ||
+           !conn.send(pixels.data(), pixels.size() * sizeof(float))) {
+            return "Lost the connection to the coordinator.";
+        }
+        jobs++;
+    }
+
+    info("Finished %zu jobs", jobs);
+    return {};
+}
+
+} // namespace Gui
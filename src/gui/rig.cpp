@@ -182,14 +182,14 @@ void Rig::hover(Vec3 cam, Vec2 spos, Vec3 dir) {
         assert(my_obj);
 
         Ray f(cam, dir);
-        PT::Trace hit1 = mesh_bvh.hit(f);
+        PT::Hit hit1 = mesh_bvh.hit(f);
         if(!hit1.hit) return;
 
-        Ray s(hit1.position + dir * EPS_F, dir);
-        PT::Trace hit2 = mesh_bvh.hit(s);
+        Ray s(f.at(hit1.distance) + dir * EPS_F, dir);
+        PT::Hit hit2 = mesh_bvh.hit(s);
 
-        Vec3 pos = hit1.position;
-        if(hit2.hit) pos = 0.5f * (hit1.position + hit2.position);
+        Vec3 pos = f.at(hit1.distance);
+        if(hit2.hit) pos = 0.5f * (pos + s.at(hit2.distance));
 
         new_joint->extent = pos - old_base;
         my_obj->set_skel_dirty();
@@ -70,39 +70,65 @@ void Simulate::build_scene(Scene& scene) {
 
     if(!scene.has_sim()) return;
 
+    // Only meshes whose geometry changed since the last build get new BVHs (or are refit,
+    // if just their vertices moved); objects that merely moved reuse their cached mesh and
+    // just go into the new scene BVH.
+    using Mesh = PT::Mesh_Cache::Mesh;
+    struct Mesh_Object {
+        Scene_Object* obj;
+        PT::Mesh_Cache::Key key;
+        Mesh cached;
+        std::future<Mesh> built;
+    };
+
     std::vector<PT::Object> obj_list;
-    std::vector<std::future<PT::Object>> futures;
+    std::vector<Mesh_Object> mesh_objects;
 
     scene.for_items([&, this](Scene_Item& item) {
         if(item.is<Scene_Object>()) {
             Scene_Object& obj = item.get<Scene_Object>();
-            futures.push_back(thread_pool.enqueue([&]() {
-                if(obj.is_shape()) {
-                    PT::Shape shape(obj.opt.shape);
-                    return PT::Object(std::move(shape), obj.id(), 0, obj.pose.transform());
-                } else {
-                    PT::Tri_Mesh mesh(obj.posed_mesh(), use_bvh);
-                    return PT::Object(std::move(mesh), obj.id(), 0, obj.pose.transform());
-                }
-            }));
+            if(obj.is_shape()) {
+                PT::Shape shape(obj.opt.shape);
+                obj_list.emplace_back(std::move(shape), obj.id(), 0, obj.pose.transform());
+                return;
+            }
+            Mesh_Object mesh;
+            mesh.obj = &obj;
+            mesh.key = {obj.id(), obj.posed_mesh_version(), obj.posed_topology_version(), use_bvh};
+            mesh.cached = mesh_cache.find(mesh.key);
+            if(!mesh.cached) {
+                Mesh refit = mesh_cache.find_refit(mesh.key);
+                mesh.built = thread_pool.enqueue([&obj, refit, this]() {
+                    if(refit && refit->refit(obj.posed_mesh(), &thread_pool)) return refit;
+                    return std::make_shared<PT::Tri_Mesh>(obj.posed_mesh(), use_bvh, &thread_pool);
+                });
+            }
+            mesh_objects.push_back(std::move(mesh));
         }
     });
 
-    for(auto& f : futures) {
-        obj_list.push_back(f.get());
+    for(Mesh_Object& mesh : mesh_objects) {
+        Mesh instance = mesh.cached ? mesh.cached : mesh.built.get();
+        mesh_cache.store(mesh.key, instance);
+        obj_list.emplace_back(std::move(instance), mesh.obj->id(), 0, mesh.obj->pose.transform());
     }
+    mesh_cache.prune();
 
     if(use_bvh) {
-        scene_obj = PT::Object(PT::BVH<PT::Object>(std::move(obj_list)));
+        PT::BVH_Options opt;
+        opt.pool = &thread_pool;
+        scene_obj = PT::Object(PT::BVH<PT::Object>(std::move(obj_list), opt));
     } else {
         scene_obj = PT::Object(PT::List<PT::Object>(std::move(obj_list)));
     }
 }
 
 void Simulate::clear_particles(Scene& scene) {
+    // Stepping again from here must match stepping a freshly loaded scene, e.g. when a
+    // render replays the simulation from its first frame
     scene.for_items([](Scene_Item& item) {
         if(item.is<Scene_Particles>()) {
-            item.get<Scene_Particles>().clear();
+            item.get<Scene_Particles>().reset();
         }
     });
 }
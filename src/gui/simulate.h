@@ -36,6 +36,7 @@ public:
 
 private:
     PT::Object scene_obj;
+    PT::Mesh_Cache mesh_cache;
     bool use_bvh = true;
 
     Thread_Pool thread_pool;
@@ -0,0 +1,29 @@
+
+#pragma once
+
+#include "../scene/object.h"
+
+namespace Gui {
+
+// Scene IDs reserved for the transform widgets. Scene items, mesh elements and joints are
+// numbered after them, so that the ID buffer tells them apart.
+enum class Widget_IDs : Scene_ID {
+    none,
+    x_mov,
+    y_mov,
+    z_mov,
+    xy_mov,
+    yz_mov,
+    xz_mov,
+    x_rot,
+    y_rot,
+    z_rot,
+    x_scl,
+    y_scl,
+    z_scl,
+    xyz_scl,
+    count
+};
+static const int n_Widget_IDs = (int)Widget_IDs::count;
+
+} // namespace Gui
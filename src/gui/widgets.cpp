@@ -1,10 +1,12 @@
 
+#include <deque>
 #include <imgui/imgui.h>
-#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <nfd/nfd.h>
+#include <optional>
 #include <sf_libs/stb_image_write.h>
-#include <sstream>
+#include <thread>
 
 #include "animate.h"
 #include "manager.h"
@@ -14,6 +16,7 @@
 #include "../geometry/util.h"
 #include "../platform/platform.h"
 #include "../scene/renderer.h"
+#include "../util/frame_writer.h"
 
 namespace Gui {
 
@@ -612,7 +615,7 @@ void Widget_Camera::generate_cage() {
     cam_cage.add(br, bl, Gui::Color::black);
 }
 
-Widget_Render::Widget_Render(Vec2 dim) : pathtracer(*this, dim) {
+Widget_Render::Widget_Render(Vec2 dim) : render_cam(dim), pathtracer(dim, ray_logger()) {
     out_w = (size_t)dim.x / 2;
     out_h = (size_t)dim.y / 2;
 }
@@ -627,6 +630,10 @@ void Widget_Render::log_ray(const Ray& ray, float t, Spectrum color) {
     ray_log.add(ray.point, ray.at(t), Vec3(color.r, color.g, color.b));
 }
 
+PT::Pathtracer::Ray_Log Widget_Render::ray_logger() {
+    return [this](const Ray& ray, float t, Spectrum color) { log_ray(ray, t, color); };
+}
+
 void Widget_Render::begin(Scene& scene, Widget_Camera& cam, Camera& user_cam) {
 
     if(render_window_focus) {
@@ -690,13 +697,7 @@ std::string Widget_Render::step(Animate& animate, Scene& scene) {
             Renderer::get().save(scene, cam, out_w, out_h, out_samples);
             Renderer::get().saved(data);
 
-            std::stringstream str;
-            str << std::setfill('0') << std::setw(4) << next_frame;
-#ifdef _WIN32
-            std::string path = folder + "\\" + str.str() + ".png";
-#else
-            std::string path = folder + "/" + str.str() + ".png";
-#endif
+            std::string path = Headless::frame_path(folder, next_frame);
 
             stbi_flip_vertically_on_write(true);
             if(!stbi_write_png(path.c_str(), (int)out_w, (int)out_h, 4, data.data(),
@@ -716,14 +717,8 @@ std::string Widget_Render::step(Animate& animate, Scene& scene) {
             if(!pathtracer.in_progress()) {
                 std::vector<unsigned char> data;
 
-                pathtracer.get_output().tonemap_to(data, exposure);
-                std::stringstream str;
-                str << std::setfill('0') << std::setw(4) << next_frame;
-#ifdef _WIN32
-                std::string path = folder + "\\" + str.str() + ".png";
-#else
-                std::string path = folder + "/" + str.str() + ".png";
-#endif
+                pathtracer.tonemap_to(data, exposure);
+                std::string path = Headless::frame_path(folder, next_frame);
 
                 stbi_flip_vertically_on_write(false);
                 if(!stbi_write_png(path.c_str(), (int)out_w, (int)out_h, 4, data.data(),
@@ -805,6 +800,11 @@ void Widget_Render::animate(Scene& scene, Widget_Camera& cam, Camera& user_cam,
     ImGui::End();
 }
 
+static bool same_camera(const Camera& a, const Camera& b) {
+    return a.get_view() == b.get_view() && a.get_fov() == b.get_fov() &&
+           a.get_ar() == b.get_ar() && a.get_ap() == b.get_ap() && a.get_dist() == b.get_dist();
+}
+
 static bool postfix(const std::string& path, const std::string& type) {
     if(path.length() >= type.length())
         return path.compare(path.length() - type.length(), type.length(), type) == 0;
@@ -818,6 +818,11 @@ bool Widget_Render::UI(Scene& scene, Widget_Camera& cam, Camera& user_cam, std::
 
     begin(scene, cam, user_cam);
 
+    if(method == 1 && live_camera && has_rendered && !same_camera(cam.get(), render_cam)) {
+        render_cam = cam.get();
+        pathtracer.restart(render_cam);
+    }
+
     ImGui::Separator();
     ImGui::Text("Render");
 
@@ -838,8 +843,9 @@ bool Widget_Render::UI(Scene& scene, Widget_Camera& cam, Camera& user_cam, std::
                 has_rendered = true;
                 ret = true;
                 ray_log.clear();
+                render_cam = cam.get();
                 pathtracer.set_params(out_w, out_h, out_samples, out_depth, use_bvh);
-                pathtracer.begin_render(scene, cam.get());
+                pathtracer.begin_render(scene, render_cam);
             } else {
                 Renderer::get().save(scene, cam.get(), out_w, out_h, out_samples);
             }
@@ -860,7 +866,7 @@ bool Widget_Render::UI(Scene& scene, Widget_Camera& cam, Camera& user_cam, std::
             std::vector<unsigned char> data;
 
             if(method == 1) {
-                pathtracer.get_output().tonemap_to(data, exposure);
+                pathtracer.tonemap_to(data, exposure);
                 stbi_flip_vertically_on_write(false);
             } else {
                 Renderer::get().saved(data);
@@ -881,6 +887,8 @@ bool Widget_Render::UI(Scene& scene, Widget_Camera& cam, Camera& user_cam, std::
             pathtracer.set_samples((int)out_samples);
             pathtracer.begin_render(scene, cam.get(), true);
         }
+        ImGui::SameLine();
+        ImGui::Checkbox("Live Camera", &live_camera);
     }
 
     float avail = ImGui::GetContentRegionAvail().x;
@@ -904,73 +912,107 @@ bool Widget_Render::UI(Scene& scene, Widget_Camera& cam, Camera& user_cam, std::
     return ret;
 }
 
+Camera Widget_Render::evaluate_frame(Animate& animate, Scene& scene, int frame,
+                                     uint32_t seed) {
+    Camera cam = animate.set_time(scene, (float)frame);
+    // Particles are emitted at random, so each step is seeded by its frame. Any process
+    // that evaluates the frames in order then simulates exactly the same particles.
+    if(frame > 0) {
+        RNG::seed(seed, 0, (uint32_t)frame);
+        animate.step_sim(scene);
+    }
+    return cam;
+}
+
 std::string Widget_Render::headless(Animate& animate, Scene& scene, const Camera& cam,
                                     const Launch_Settings& set) {
 
-    info("Render settings:");
-    info("\twidth: %d", set.w);
-    info("\theight: %d", set.h);
-    info("\tsamples: %d", set.s);
-    info("\tmax depth: %d", set.d);
-    info("\texposure: %f", set.exp);
-    info("\trender threads: %u", std::thread::hardware_concurrency());
-    if(set.no_bvh) info("\tusing object list instead of BVH");
+    if(!set.worker.empty()) return work(animate, scene, cam, set);
+
+    Headless::print_settings(set);
 
     out_w = set.w;
     out_h = set.h;
-    pathtracer.set_params(set.w, set.h, set.s, set.d, !set.no_bvh);
-
-    auto print_progress = [](float f) {
-        std::cout << "Progress: [";
-
-        int width = std::min(Platform::console_width() - 30, 50);
-        if(width) {
-            int bar = (int)(width * f);
-            for(int i = 0; i < bar; i++) std::cout << "-";
-            for(int i = bar; i < width; i++) std::cout << " ";
-            std::cout << "] ";
-        }
+    Headless::configure(pathtracer, set);
+
+    if(set.coordinator > 0) return coordinate(animate, set);
+
+    if(!set.animate) return Headless::render_frame(pathtracer, scene, cam, set);
+
+    if(set.resume) return "--resume is not supported with --animate.";
+
+    max_frame = animate.n_frames();
+    folder = set.output_file;
+    if(folder.empty()) return "No output folder!";
+    // Frames are pipelined: while frames are traced, the scene of the next frame is
+    // evaluated and built into a spare tracer, and finished frames are encoded in the
+    // background. Small frames parallelize poorly, so several may be traced at once,
+    // each by its own tracer with a share of the threads.
+    size_t parallel = (size_t)std::max(1, std::min(set.parallel_frames, max_frame));
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t share = std::max(size_t(1), threads / parallel);
+    if(parallel > 1) info("\ttracing %zu frames at once, %zu threads each", parallel, share);
+
+    std::vector<std::unique_ptr<PT::Pathtracer>> extra;
+    std::vector<PT::Pathtracer*> idle = {&pathtracer};
+    for(size_t i = 0; i < parallel; i++) {
+        Vec2 dim((float)set.w, (float)set.h);
+        extra.push_back(std::make_unique<PT::Pathtracer>(dim, ray_logger()));
+        idle.push_back(extra.back().get());
+    }
+    for(PT::Pathtracer* tracer : idle) {
+        if(parallel > 1) tracer->set_threads(share);
+        Headless::configure(*tracer, set);
+    }
+    Frame_Writer writer(set.exp, 2);
 
-        float percent = 100.0f * f;
-        if(percent < 10.0f) std::cout << "0";
-        std::cout << percent << "%\r";
-        std::cout.flush();
+    struct Frame {
+        int index;
+        PT::Pathtracer* tracer;
+        Camera cam;
     };
 
-    std::cout << std::fixed << std::setw(2) << std::setprecision(2) << std::setfill('0');
-    if(set.animate) {
-
-        method = 1;
-        init = true;
-        animating = true;
-        max_frame = animate.n_frames();
-        next_frame = 0;
-        folder = set.output_file;
-        while(next_frame < max_frame) {
-            std::string err = step(animate, scene);
-            if(!err.empty()) return err;
-            print_progress(((float)next_frame + pathtracer.progress()) / (max_frame + 1));
-            std::this_thread::sleep_for(std::chrono::milliseconds(250));
-        }
-        std::cout << std::endl;
+    // Frames are evaluated in order on this thread, so the simulation advances
+    // deterministically, once between consecutive frames, however they are traced
+    int next_index = 0;
+    auto prepare = [&]() -> std::optional<Frame> {
+        if(next_index == max_frame || idle.empty()) return std::nullopt;
+        PT::Pathtracer* tracer = idle.back();
+        idle.pop_back();
+        Camera frame_cam = evaluate_frame(animate, scene, next_index, set.seed);
+        tracer->prebuild(scene);
+        return Frame{next_index++, tracer, frame_cam};
+    };
 
-    } else {
+    std::deque<Frame> tracing;
+    std::optional<Frame> built;
+    while(true) {
 
-        pathtracer.begin_render(scene, cam);
-        while(pathtracer.in_progress()) {
-            print_progress(pathtracer.progress());
-            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        // Start frames while there are free slots, then build one more ahead
+        if(!built) built = prepare();
+        while(built && tracing.size() < parallel) {
+            built->tracer->begin_render(scene, built->cam);
+            tracing.push_back(*built);
+            built = prepare();
         }
-        std::cout << std::endl;
+        if(tracing.empty()) break;
 
-        std::vector<unsigned char> data;
-        pathtracer.get_output().tonemap_to(data, set.exp);
-        if(!stbi_write_png(set.output_file.c_str(), set.w, set.h, 4, data.data(), set.w * 4)) {
-            return "Failed to write output!";
+        // Frames start in order and take similar time, so wait for the oldest
+        Frame& frame = tracing.front();
+        while(!frame.tracer->wait(std::chrono::milliseconds(250))) {
+            float done = (float)frame.index + frame.tracer->progress();
+            Headless::print_progress(done / max_frame);
         }
+        std::string err = writer.push(frame.tracer->snapshot(),
+                                      Headless::frame_path(folder, frame.index, set.frame_format));
+        if(!err.empty()) return err;
+        idle.push_back(frame.tracer);
+        tracing.pop_front();
     }
+    Headless::print_progress(1.0f);
+    std::cout << std::endl;
 
-    return {};
+    return writer.finish();
 }
 
 void Widget_Render::render_log(const Mat4& view) const {
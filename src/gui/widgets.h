@@ -5,6 +5,8 @@
 #include "../rays/pathtracer.h"
 #include "../scene/scene.h"
 
+#include "widget_ids.h"
+
 class Undo;
 struct Launch_Settings;
 
@@ -17,25 +19,6 @@ enum class Axis { X, Y, Z };
 enum class Widget_Type { move, rotate, scale, bevel, extrude, count };
 static const int n_Widget_Types = (int)Widget_Type::count;
 
-enum class Widget_IDs : Scene_ID {
-    none,
-    x_mov,
-    y_mov,
-    z_mov,
-    xy_mov,
-    yz_mov,
-    xz_mov,
-    x_rot,
-    y_rot,
-    z_rot,
-    x_scl,
-    y_scl,
-    z_scl,
-    xyz_scl,
-    count
-};
-static const int n_Widget_IDs = (int)Widget_IDs::count;
-
 class Widget_Camera {
 public:
     Widget_Camera(Vec2 screen_dim)
@@ -109,6 +92,18 @@ public:
 
 private:
     void begin(Scene& scene, Widget_Camera& cam, Camera& user_cam);
+    // Sends the rays a Pathtracer logs to log_ray
+    PT::Pathtracer::Ray_Log ray_logger();
+
+    // Evaluate the scene at a frame of a headless animation, after every earlier frame
+    Camera evaluate_frame(Animate& animate, Scene& scene, int frame, uint32_t seed);
+
+    // Distributed headless renders, implemented in distributed.cpp. The coordinator hands
+    // out tiles of a frame, or frames of an animation, to workers that connect to it and
+    // merges what they send back.
+    std::string coordinate(Animate& animate, const Launch_Settings& set);
+    std::string work(Animate& animate, Scene& scene, const Camera& cam,
+                     const Launch_Settings& set);
 
     mutable std::mutex log_mut;
     GL::Lines ray_log;
@@ -118,6 +113,9 @@ private:
     bool use_bvh = true;
 
     bool has_rendered = false;
+    // Restart path-traced renders whenever the camera moves, reusing the built scene
+    bool live_camera = false;
+    Camera render_cam;
     bool render_window = false, render_window_focus = false;
 
     int method = 1;
@@ -0,0 +1,210 @@
+
+#include "headless.h"
+#include "lib/log.h"
+#include "rays/pathtracer.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <sf_libs/CLI11.hpp>
+#include <sf_libs/stb_image_write.h>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/ioctl.h>
+#endif
+
+namespace Headless {
+
+static int console_width() {
+    int cols = 0;
+#ifdef _WIN32
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi);
+    cols = csbi.srWindow.Right - csbi.srWindow.Left + 1;
+#else
+    struct winsize w;
+    ioctl(0, TIOCGWINSZ, &w);
+    cols = w.ws_col;
+#endif
+    return cols;
+}
+
+void add_options(CLI::App& args, Launch_Settings& set, const std::string& note) {
+
+    auto help = [&note](const char* text) { return text + note; };
+
+    args.add_option("-s,--scene", set.scene_file, "Scene file to load");
+    args.add_option("--env_map", set.env_map_file, "Override scene environment map");
+    args.add_option("-o,--output", set.output_file,
+                    help("Image file to write: .exr and .pfm keep linear radiance, anything "
+                         "else is tonemapped to PNG"));
+    args.add_flag("--no_bvh", set.no_bvh, help("Don't use BVH"));
+    args.add_option("--width", set.w, help("Output image width"));
+    args.add_option("--height", set.h, help("Output image height"));
+    args.add_flag("--use_ar", set.w_from_ar,
+                  help("Compute output image width based on camera AR"));
+    args.add_option("--depth", set.d, help("Maximum ray depth"));
+    args.add_option("--samples", set.s, help("Pixel samples"));
+    args.add_option("--adaptive_error", set.adapt_err,
+                    help("Stop sampling pixels below this relative error, spending --samples "
+                         "per pixel on average"));
+    args.add_option("--max_samples", set.max_s,
+                    help("Maximum pixel samples when sampling adaptively, default 4x "
+                         "--samples"));
+    args.add_option("--exposure", set.exp, help("Output exposure"));
+    args.add_option("--seed", set.seed, help("Random seed"));
+    args.add_flag("--independent", set.independent,
+                  help("Use independent random samples instead of Sobol points"));
+    args.add_option("--checkpoint", set.checkpoint_file,
+                    help("Periodically save the render's progress to this file, and write "
+                         "the output image alongside it"));
+    args.add_option("--checkpoint_interval", set.checkpoint_interval,
+                    help("Seconds between checkpoints"));
+    args.add_flag("--resume", set.resume,
+                  help("Continue the render saved in --checkpoint, up to --samples per pixel"));
+}
+
+static int max_samples(const Launch_Settings& set) {
+    return set.max_s > 0 ? set.max_s : 4 * set.s;
+}
+
+void print_settings(const Launch_Settings& set) {
+    info("Render settings:");
+    info("\twidth: %d", set.w);
+    info("\theight: %d", set.h);
+    info("\tsamples: %d", set.s);
+    if(set.adapt_err > 0.0f) {
+        info("\tadaptive sampling: relative error %f, at most %d samples", set.adapt_err,
+             max_samples(set));
+    }
+    info("\tmax depth: %d", set.d);
+    info("\texposure: %f", set.exp);
+    info("\tseed: %u", set.seed);
+    if(set.independent) info("\tusing independent samples instead of Sobol points");
+    info("\trender threads: %u", std::thread::hardware_concurrency());
+    if(set.no_bvh) info("\tusing object list instead of BVH");
+}
+
+void configure(PT::Pathtracer& tracer, const Launch_Settings& set) {
+    tracer.set_params(set.w, set.h, set.s, set.d, !set.no_bvh);
+    tracer.set_adaptive(set.adapt_err, max_samples(set));
+    tracer.set_seed(set.seed);
+    tracer.set_sequence(set.independent ? RNG::Sequence::independent : RNG::Sequence::sobol);
+}
+
+void print_progress(float f) {
+    std::cout << std::fixed << std::setprecision(2) << "Progress: [";
+
+    int width = std::min(console_width() - 30, 50);
+    if(width) {
+        int bar = (int)(width * f);
+        for(int i = 0; i < bar; i++) std::cout << "-";
+        for(int i = bar; i < width; i++) std::cout << " ";
+        std::cout << "] ";
+    }
+
+    float percent = 100.0f * f;
+    if(percent < 10.0f) std::cout << "0";
+    std::cout << percent << "%\r";
+    std::cout.flush();
+}
+
+std::string frame_path(const std::string& folder, int frame, const std::string& format) {
+    std::stringstream str;
+    str << std::setfill('0') << std::setw(4) << frame;
+#ifdef _WIN32
+    return folder + "\\" + str.str() + "." + format;
+#else
+    return folder + "/" + str.str() + "." + format;
+#endif
+}
+
+// Summarize where adaptive sampling spent its samples, in power-of-two buckets
+static void print_samples(const PT::Pathtracer& tracer) {
+    std::vector<size_t> spp = tracer.samples_per_pixel();
+    if(spp.empty()) return;
+
+    size_t lo = SIZE_MAX, hi = 0, total = 0;
+    std::vector<size_t> buckets;
+    for(size_t s : spp) {
+        lo = std::min(lo, s);
+        hi = std::max(hi, s);
+        total += s;
+        size_t b = 0;
+        while((size_t(2) << b) <= s) b++;
+        if(b >= buckets.size()) buckets.resize(b + 1);
+        buckets[b]++;
+    }
+
+    info("Samples per pixel: min %zu, mean %.1f, max %zu", lo, (double)total / spp.size(), hi);
+    for(size_t b = 0; b < buckets.size(); b++) {
+        if(!buckets[b]) continue;
+        info("\t%zu-%zu: %.1f%% of pixels", size_t(1) << b, (size_t(2) << b) - 1,
+             100.0 * buckets[b] / spp.size());
+    }
+}
+
+std::string render_frame(PT::Pathtracer& tracer, Scene& scene, const Camera& cam,
+                         const Launch_Settings& set) {
+
+    // Linear formats keep the raw radiance; anything else is tonemapped to PNG.
+    // Snapshots are consistent even while the workers are still accumulating.
+    auto write_output = [&]() -> std::string {
+        HDR_Image image = tracer.snapshot();
+        if(HDR_Image::can_save(set.output_file)) return image.save_to(set.output_file);
+
+        std::vector<unsigned char> data;
+        image.tonemap_to(data, set.exp);
+        if(!stbi_write_png(set.output_file.c_str(), set.w, set.h, 4, data.data(), set.w * 4)) {
+            return "Failed to write output!";
+        }
+        return {};
+    };
+
+    auto checkpoint = [&]() -> std::string {
+        if(set.checkpoint_file.empty()) return {};
+        std::string err = tracer.save_checkpoint(set.checkpoint_file);
+        if(!err.empty()) return "Failed to save checkpoint: " + err;
+        return write_output();
+    };
+
+    if(set.resume) {
+        if(set.checkpoint_file.empty()) return "--resume requires --checkpoint.";
+        std::string err = tracer.load_checkpoint(set.checkpoint_file);
+        if(!err.empty()) return "Failed to resume: " + err;
+        info("Resuming from %s", set.checkpoint_file.c_str());
+        tracer.begin_render(scene, cam, true);
+    } else {
+        tracer.begin_render(scene, cam);
+    }
+
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    while(tracer.in_progress()) {
+        print_progress(tracer.progress());
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+        auto now = std::chrono::steady_clock::now();
+        if(std::chrono::duration<float>(now - last_checkpoint).count() >=
+           set.checkpoint_interval) {
+            std::string err = checkpoint();
+            if(!err.empty()) warn("%s", err.c_str());
+            last_checkpoint = now;
+        }
+    }
+    print_progress(1.0f);
+    std::cout << std::endl;
+
+    if(set.adapt_err > 0.0f) print_samples(tracer);
+
+    // The final checkpoint lets a later --resume add more samples
+    std::string err = checkpoint();
+    if(!err.empty()) return err;
+    if(set.checkpoint_file.empty()) return write_output();
+    return {};
+}
+
+} // namespace Headless
@@ -0,0 +1,69 @@
+
+#pragma once
+
+#include <string>
+
+class Camera;
+class Scene;
+
+namespace CLI {
+class App;
+}
+namespace PT {
+class Pathtracer;
+}
+
+struct Launch_Settings {
+
+    std::string scene_file;
+    std::string env_map_file;
+    bool headless = false;
+
+    // If headless is true, use all of these
+    std::string output_file = "out.png";
+    int w = 640;
+    int h = 360;
+    int s = 256;
+    int d = 8;
+    float adapt_err = 0.0f;
+    int max_s = 0;
+    unsigned int seed = 0;
+    bool independent = false;
+    bool animate = false;
+    // Image type of animation frames: png, or exr/pfm for linear radiance
+    std::string frame_format = "png";
+    int parallel_frames = 1;
+    float exp = 1.0f;
+    bool w_from_ar = false;
+    bool no_bvh = false;
+    std::string checkpoint_file;
+    float checkpoint_interval = 60.0f;
+    bool resume = false;
+    // Distributed rendering: listen for workers on this port, or work for host:port
+    int coordinator = 0;
+    std::string worker;
+};
+
+// Headless rendering shared by Scotty3D --headless and scotty3d_render, which is built
+// without SDL, OpenGL or the GUI.
+namespace Headless {
+
+/// Add the options of single-frame headless renders to args, appending note to their
+/// descriptions
+void add_options(CLI::App& args, Launch_Settings& set, const std::string& note = {});
+
+/// Log the render settings
+void print_settings(const Launch_Settings& set);
+/// Apply the render settings to tracer
+void configure(PT::Pathtracer& tracer, const Launch_Settings& set);
+/// Draw a progress bar for f in [0,1] over the current console line
+void print_progress(float f);
+/// Path of an animation frame's image of type format in folder, e.g. folder/0012.png
+std::string frame_path(const std::string& folder, int frame, const std::string& format = "png");
+
+/// Trace a single frame with tracer and write it to set.output_file, saving and
+/// resuming from checkpoints as set asks. The tracer must already be configured.
+std::string render_frame(PT::Pathtracer& tracer, Scene& scene, const Camera& cam,
+                         const Launch_Settings& set);
+
+} // namespace Headless
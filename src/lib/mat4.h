@@ -8,6 +8,14 @@
 #include "log.h"
 #include "vec4.h"
 
+// With SCOTTY3D_SIMD_MATH defined (see CMakeLists.txt), matrix products, transposes and
+// inverses work on whole columns with SSE. Matrices are stored as four 16-byte columns
+// either way, so both versions share the same layout and API.
+#if defined(SCOTTY3D_SIMD_MATH) && (defined(__SSE__) || defined(_M_X64))
+#define SCOTTY3D_MAT4_SSE
+#include <xmmintrin.h>
+#endif
+
 struct Mat4 {
 
     /// Identity matrix
@@ -133,6 +141,40 @@ struct Mat4 {
         *this = *this * v;
         return *this;
     }
+#ifdef SCOTTY3D_MAT4_SSE
+    Mat4 operator*(const Mat4& m) const {
+        Mat4 ret;
+        __m128 c0 = column(0), c1 = column(1), c2 = column(2), c3 = column(3);
+        for(int i = 0; i < 4; i++) {
+            const float* v = m.cols[i].data;
+            __m128 r = _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(v[0])),
+                                  _mm_mul_ps(c1, _mm_set1_ps(v[1])));
+            r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(v[2])));
+            r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_set1_ps(v[3])));
+            _mm_storeu_ps(ret.cols[i].data, r);
+        }
+        return ret;
+    }
+
+    Vec4 operator*(Vec4 v) const {
+        Vec4 ret;
+        _mm_storeu_ps(ret.data, combine(v.x, v.y, v.z, _mm_mul_ps(column(3), _mm_set1_ps(v.w))));
+        return ret;
+    }
+
+    /// Expands v to Vec4(v, 1.0), multiplies, and projects back to 3D
+    Vec3 operator*(Vec3 v) const {
+        alignas(16) float r[4];
+        _mm_store_ps(r, combine(v.x, v.y, v.z, column(3)));
+        return Vec3(r[0] / r[3], r[1] / r[3], r[2] / r[3]);
+    }
+    /// Expands v to Vec4(v, 0.0), multiplies, and projects back to 3D
+    Vec3 rotate(Vec3 v) const {
+        alignas(16) float r[4];
+        _mm_store_ps(r, combine(v.x, v.y, v.z, _mm_setzero_ps()));
+        return Vec3(r[0], r[1], r[2]);
+    }
+#else
     Mat4 operator*(const Mat4& m) const {
         Mat4 ret;
         for(int i = 0; i < 4; i++) {
@@ -158,6 +200,7 @@ struct Mat4 {
     Vec3 rotate(Vec3 v) const {
         return operator*(Vec4(v, 0.0f)).xyz();
     }
+#endif
 
     /// Converts rotation (orthonormal 3x3) matrix to equivalent Euler angles
     Vec3 to_euler() const {
@@ -239,6 +282,19 @@ struct Mat4 {
         Vec4 cols[4];
         float data[16] = {};
     };
+
+#ifdef SCOTTY3D_MAT4_SSE
+private:
+    __m128 column(int i) const {
+        return _mm_loadu_ps(cols[i].data);
+    }
+    // x * cols[0] + y * cols[1] + z * cols[2] + w, where w holds the last column's term
+    __m128 combine(float x, float y, float z, __m128 w) const {
+        __m128 r = _mm_add_ps(_mm_mul_ps(column(0), _mm_set1_ps(x)),
+                              _mm_mul_ps(column(1), _mm_set1_ps(y)));
+        return _mm_add_ps(_mm_add_ps(r, _mm_mul_ps(column(2), _mm_set1_ps(z))), w);
+    }
+#endif
 };
 
 inline bool operator==(const Mat4& l, const Mat4& r) {
@@ -286,6 +342,90 @@ inline Mat4 outer(Vec4 u, Vec4 v) {
     return B;
 }
 
+#ifdef SCOTTY3D_MAT4_SSE
+
+inline Mat4 Mat4::transpose(const Mat4& m) {
+    __m128 c0 = m.column(0), c1 = m.column(1), c2 = m.column(2), c3 = m.column(3);
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+    Mat4 r;
+    _mm_storeu_ps(r.cols[0].data, c0);
+    _mm_storeu_ps(r.cols[1].data, c1);
+    _mm_storeu_ps(r.cols[2].data, c2);
+    _mm_storeu_ps(r.cols[3].data, c3);
+    return r;
+}
+
+inline Mat4 Mat4::inverse(const Mat4& m) {
+
+    // Cofactor expansion over 2x2 minors. Writing a_ij = m[i][j], s_k and c_k are the
+    // minors of columns 0,1 and 2,3 over the row pairs (0,1) (0,2) (0,3) (1,2) (1,3) (2,3).
+    // Each column of the adjugate is then three products of a gathered column of a with
+    // broadcast minors, with alternating signs.
+    __m128 a0 = m.column(0), a1 = m.column(1), a2 = m.column(2), a3 = m.column(3);
+
+    auto minors = [](__m128 p, __m128 q, __m128& lo, __m128& hi) {
+        // Row pairs (0,1) (0,2) (0,3) (1,2) in lo, and (1,3) (2,3) twice in hi
+        __m128 px = _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 0, 0, 0));
+        __m128 py = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 3, 2, 1));
+        __m128 qx = _mm_shuffle_ps(q, q, _MM_SHUFFLE(1, 0, 0, 0));
+        __m128 qy = _mm_shuffle_ps(q, q, _MM_SHUFFLE(2, 3, 2, 1));
+        lo = _mm_sub_ps(_mm_mul_ps(px, qy), _mm_mul_ps(qx, py));
+        px = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 1, 2, 1));
+        qx = _mm_shuffle_ps(q, q, _MM_SHUFFLE(2, 1, 2, 1));
+        py = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3));
+        qy = _mm_shuffle_ps(q, q, _MM_SHUFFLE(3, 3, 3, 3));
+        hi = _mm_sub_ps(_mm_mul_ps(px, qy), _mm_mul_ps(qx, py));
+    };
+    __m128 s_lo, s_hi, c_lo, c_hi;
+    minors(a0, a1, s_lo, s_hi);
+    minors(a2, a3, c_lo, c_hi);
+
+    // (c_k, c_k, s_k, s_k) for each of the six minors
+    __m128 k0 = _mm_shuffle_ps(c_lo, s_lo, _MM_SHUFFLE(0, 0, 0, 0));
+    __m128 k1 = _mm_shuffle_ps(c_lo, s_lo, _MM_SHUFFLE(1, 1, 1, 1));
+    __m128 k2 = _mm_shuffle_ps(c_lo, s_lo, _MM_SHUFFLE(2, 2, 2, 2));
+    __m128 k3 = _mm_shuffle_ps(c_lo, s_lo, _MM_SHUFFLE(3, 3, 3, 3));
+    __m128 k4 = _mm_shuffle_ps(c_hi, s_hi, _MM_SHUFFLE(0, 0, 0, 0));
+    __m128 k5 = _mm_shuffle_ps(c_hi, s_hi, _MM_SHUFFLE(1, 1, 1, 1));
+
+    // r_j holds element j of columns 1, 0, 3 and 2
+    _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+    __m128 r0 = _mm_shuffle_ps(a0, a0, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 r1 = _mm_shuffle_ps(a1, a1, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 r2 = _mm_shuffle_ps(a2, a2, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 r3 = _mm_shuffle_ps(a3, a3, _MM_SHUFFLE(2, 3, 0, 1));
+
+    auto expand = [](__m128 a, __m128 x, __m128 b, __m128 y, __m128 c, __m128 z) {
+        return _mm_add_ps(_mm_sub_ps(_mm_mul_ps(a, x), _mm_mul_ps(b, y)), _mm_mul_ps(c, z));
+    };
+    __m128 sign = _mm_setr_ps(1.0f, -1.0f, 1.0f, -1.0f);
+    __m128 b0 = _mm_mul_ps(sign, expand(r1, k5, r2, k4, r3, k3));
+    __m128 b1 = _mm_mul_ps(sign, expand(r0, k5, r2, k2, r3, k1));
+    __m128 b2 = _mm_mul_ps(sign, expand(r0, k4, r1, k2, r3, k0));
+    __m128 b3 = _mm_mul_ps(sign, expand(r0, k3, r1, k1, r2, k0));
+    b1 = _mm_sub_ps(_mm_setzero_ps(), b1);
+    b3 = _mm_sub_ps(_mm_setzero_ps(), b3);
+
+    // The determinant is row 0 of m dotted with column 0 of the adjugate
+    alignas(16) float a[4], b[4][4];
+    _mm_store_ps(a, m.column(0));
+    _mm_store_ps(b[0], b0);
+    _mm_store_ps(b[1], b1);
+    _mm_store_ps(b[2], b2);
+    _mm_store_ps(b[3], b3);
+    float det = a[0] * b[0][0] + a[1] * b[1][0] + a[2] * b[2][0] + a[3] * b[3][0];
+    __m128 inv = _mm_set1_ps(1.0f / det);
+
+    Mat4 r;
+    _mm_storeu_ps(r.cols[0].data, _mm_mul_ps(b0, inv));
+    _mm_storeu_ps(r.cols[1].data, _mm_mul_ps(b1, inv));
+    _mm_storeu_ps(r.cols[2].data, _mm_mul_ps(b2, inv));
+    _mm_storeu_ps(r.cols[3].data, _mm_mul_ps(b3, inv));
+    return r;
+}
+
+#else
+
 inline Mat4 Mat4::transpose(const Mat4& m) {
     Mat4 r;
     for(int i = 0; i < 4; i++) {
@@ -350,6 +490,8 @@ inline Mat4 Mat4::inverse(const Mat4& m) {
     return r;
 }
 
+#endif
+
 inline Mat4 Mat4::rotate_to(Vec3 dir) {
 
     dir.normalize();
@@ -10,22 +10,28 @@ int main(int argc, char** argv) {
     Launch_Settings set;
     CLI::App args{"Scotty3D - 15-462"};
 
-    args.add_option("-s,--scene", set.scene_file, "Scene file to load");
-    args.add_option("--env_map", set.env_map_file, "Override scene environment map");
+    Headless::add_options(args, set, " (if headless)");
     args.add_flag("--headless", set.headless, "Path-trace scene without opening the GUI");
-    args.add_option("-o,--output", set.output_file, "Image file to write (if headless)");
-    args.add_flag("--animate", set.animate, "Output animation frames (if headless)");
-    args.add_flag("--no_bvh", set.no_bvh, "Don't use BVH (if headless)");
-    args.add_option("--width", set.w, "Output image width (if headless)");
-    args.add_option("--height", set.h, "Output image height (if headless)");
-    args.add_flag("--use_ar", set.w_from_ar,
-                  "Compute output image width based on camera AR (if headless)");
-    args.add_option("--depth", set.d, "Maximum ray depth (if headless)");
-    args.add_option("--samples", set.s, "Pixel samples (if headless)");
-    args.add_option("--exposure", set.exp, "Output exposure (if headless)");
+    args.add_flag("--animate", set.animate,
+                  "Output animation frames to the --output folder, without checkpoints "
+                  "(if headless)");
+    args.add_option("--frame_format", set.frame_format,
+                    "Image type of --animate frames: png, or exr/pfm to keep linear radiance "
+                    "(if headless)")
+        ->check(CLI::IsMember({"png", "exr", "pfm"}));
+    args.add_option("--parallel_frames", set.parallel_frames,
+                    "Trace this many animation frames at once, splitting the threads between "
+                    "them; helps small, cheap frames (if headless)");
+    args.add_option("--coordinator", set.coordinator,
+                    "Render headless by handing out tiles (or animation frames) to --worker "
+                    "processes that connect to this port");
+    args.add_option("--worker", set.worker,
+                    "Render headless for the coordinator at host:port, using its settings");
 
     CLI11_PARSE(args, argc, argv);
 
+    if(set.coordinator > 0 || !set.worker.empty()) set.headless = true;
+
     if(!set.headless) {
         Platform plt;
         App app(set, &plt);
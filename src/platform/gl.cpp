@@ -6,6 +6,7 @@
 
 namespace GL {
 
+#ifndef SCOTTY3D_HEADLESS
 const char* Sample_Count_Names[(int)Sample_Count::count] = {"1", "2", "4", "8", "16", "32"};
 
 int MSAA::n_options() {
@@ -160,9 +161,19 @@ void Tex2D::image(int w, int h, unsigned char* img) {
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+void Tex2D::update(int x, int y, int w, int h, int stride, const unsigned char* img) {
+    assert(id);
+    glBindTexture(GL_TEXTURE_2D, id);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, stride);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, img);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
 TexID Tex2D::get_id() const {
     return id;
 }
+#endif
 
 Mesh::Mesh() {
     create();
@@ -213,6 +224,7 @@ Mesh::~Mesh() {
 }
 
 void Mesh::create() {
+#ifndef SCOTTY3D_HEADLESS
     // Hack to let stuff get created for headless mode
     if(!glGenVertexArrays) return;
 
@@ -235,9 +247,11 @@ void Mesh::create() {
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
 
     glBindVertexArray(0);
+#endif
 }
 
 void Mesh::destroy() {
+#ifndef SCOTTY3D_HEADLESS
     // Hack to let stuff get destroyed for headless mode
     if(!glDeleteBuffers) return;
 
@@ -245,8 +259,10 @@ void Mesh::destroy() {
     glDeleteBuffers(1, &vbo);
     glDeleteVertexArrays(1, &vao);
     ebo = vao = vbo = 0;
+#endif
 }
 
+#ifndef SCOTTY3D_HEADLESS
 void Mesh::update() {
     glBindVertexArray(vao);
 
@@ -261,6 +277,7 @@ void Mesh::update() {
 
     dirty = false;
 }
+#endif
 
 void Mesh::recreate(std::vector<Vert>&& vertices, std::vector<Index>&& indices) {
 
@@ -307,12 +324,14 @@ BBox Mesh::bbox() const {
     return _bbox;
 }
 
+#ifndef SCOTTY3D_HEADLESS
 void Mesh::render() {
     if(dirty) update();
     glBindVertexArray(vao);
     glDrawElements(GL_TRIANGLES, n_elem, GL_UNSIGNED_INT, nullptr);
     glBindVertexArray(0);
 }
+#endif
 
 Instances::Instances(Mesh&& mesh) : _mesh(std::move(mesh)) {
     create();
@@ -346,6 +365,7 @@ void Instances::operator=(Instances&& src) {
 }
 
 void Instances::create() {
+#ifndef SCOTTY3D_HEADLESS
     // Hack to let stuff get created for headless mode
     if(!glGenBuffers) return;
 
@@ -365,8 +385,10 @@ void Instances::create() {
         glVertexAttribDivisor(base_idx + i, 1);
     }
     glBindVertexArray(0);
+#endif
 }
 
+#ifndef SCOTTY3D_HEADLESS
 void Instances::render() {
 
     if(_mesh.dirty) _mesh.update();
@@ -377,6 +399,7 @@ void Instances::render() {
                             (GLsizei)data.size());
     glBindVertexArray(0);
 }
+#endif
 
 Instances::Info& Instances::get(size_t idx) {
     dirty = true;
@@ -397,6 +420,7 @@ void Instances::clear(size_t n) {
     dirty = true;
 }
 
+#ifndef SCOTTY3D_HEADLESS
 void Instances::update() {
     glBindVertexArray(_mesh.vao);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
@@ -404,14 +428,17 @@ void Instances::update() {
     glBindVertexArray(0);
     dirty = false;
 }
+#endif
 
 void Instances::destroy() {
+#ifndef SCOTTY3D_HEADLESS
     // Hack to let stuff get destroyed for headless mode
     if(!glDeleteBuffers) return;
 
     glDeleteBuffers(1, &vbo);
     vbo = 0;
     _mesh.destroy();
+#endif
 }
 
 Lines::Lines(std::vector<Vert>&& verts, float thickness)
@@ -453,6 +480,7 @@ Lines::~Lines() {
     destroy();
 }
 
+#ifndef SCOTTY3D_HEADLESS
 void Lines::update() const {
 
     glBindVertexArray(vao);
@@ -462,7 +490,9 @@ void Lines::update() const {
 
     dirty = false;
 }
+#endif
 
+#ifndef SCOTTY3D_HEADLESS
 void Lines::render(bool smooth) const {
 
     if(dirty) update();
@@ -477,6 +507,7 @@ void Lines::render(bool smooth) const {
     glDrawArrays(GL_LINES, 0, (GLsizei)vertices.size());
     glBindVertexArray(0);
 }
+#endif
 
 void Lines::clear() {
     vertices.clear();
@@ -497,6 +528,7 @@ void Lines::add(Vec3 start, Vec3 end, Vec3 color) {
 }
 
 void Lines::create() {
+#ifndef SCOTTY3D_HEADLESS
     // Hack to let stuff get created for headless mode
     if(!glGenBuffers) return;
 
@@ -513,9 +545,11 @@ void Lines::create() {
     glEnableVertexAttribArray(1);
 
     glBindVertexArray(0);
+#endif
 }
 
 void Lines::destroy() {
+#ifndef SCOTTY3D_HEADLESS
     // Hack to let stuff get destroyed for headless mode
     if(!glDeleteBuffers) return;
 
@@ -524,8 +558,10 @@ void Lines::destroy() {
     vao = vbo = 0;
     vertices.clear();
     dirty = false;
+#endif
 }
 
+#ifndef SCOTTY3D_HEADLESS
 Shader::Shader() {
 }
 
@@ -1317,4 +1353,5 @@ void main() {
 })";
 
 } // namespace Shaders
+#endif
 } // namespace GL
@@ -6,10 +6,21 @@
 #include <vector>
 
 #include "../lib/mathlib.h"
+
+#ifdef SCOTTY3D_HEADLESS
+// Headless builds have no OpenGL. Meshes, instances and lines remain as CPU-side
+// containers of their vertices, and nothing else in this file exists.
+using GLuint = unsigned int;
+using GLint = int;
+using GLfloat = float;
+using GLubyte = unsigned char;
+#else
 #include <glad/glad.h>
+#endif
 
 namespace GL {
 
+#ifndef SCOTTY3D_HEADLESS
 enum class Sample_Count { _1, _2, _4, _8, _16, _32, count };
 extern const char* Sample_Count_Names[(int)Sample_Count::count];
 
@@ -49,12 +60,15 @@ public:
     void operator=(Tex2D&& src);
 
     void image(int w, int h, unsigned char* img);
+    /// Replace the w x h region at (x, y) with RGBA8 pixels whose rows are stride apart
+    void update(int x, int y, int w, int h, int stride, const unsigned char* img);
     TexID get_id() const;
     void bind(int idx = 0) const;
 
 private:
     GLuint id;
 };
+#endif
 
 class Mesh {
 public:
@@ -74,8 +88,10 @@ public:
     void operator=(const Mesh& src) = delete;
     void operator=(Mesh&& src);
 
+#ifndef SCOTTY3D_HEADLESS
     /// Assumes proper shader is already bound
     void render();
+#endif
 
     void recreate(std::vector<Vert>&& vertices, std::vector<Index>&& indices);
     std::vector<Vert>& edit_verts();
@@ -118,7 +134,9 @@ public:
         Mat4 transform;
     };
 
+#ifndef SCOTTY3D_HEADLESS
     void render();
+#endif
     size_t add(const Mat4& transform, GLuint id = 0);
     Info& get(size_t idx);
     void clear(size_t n = 0);
@@ -152,8 +170,10 @@ public:
     void operator=(const Lines& src) = delete;
     void operator=(Lines&& src);
 
+#ifndef SCOTTY3D_HEADLESS
     /// Assumes proper shader is already bound
     void render(bool smooth) const;
+#endif
     void add(Vec3 start, Vec3 end, Vec3 color);
     void pop();
     void clear();
@@ -170,6 +190,7 @@ private:
     std::vector<Vert> vertices;
 };
 
+#ifndef SCOTTY3D_HEADLESS
 class Shader {
 public:
     Shader();
@@ -287,4 +308,5 @@ extern const std::string inst_v;
 extern const std::string dome_v, dome_f;
 
 } // namespace Shaders
+#endif
 } // namespace GL
@@ -17,23 +17,7 @@ extern "C" {
 __declspec(dllexport) bool NvOptimusEnablement = true;
 __declspec(dllexport) bool AmdPowerXpressRequestHighPerformance = true;
 }
-#else
-#include <sys/ioctl.h>
-#endif
-
-int Platform::console_width() {
-    int cols = 0;
-#ifdef _WIN32
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-    GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi);
-    cols = csbi.srWindow.Right - csbi.srWindow.Left + 1;
-#else
-    struct winsize w;
-    ioctl(0, TIOCGWINSZ, &w);
-    cols = w.ws_col;
 #endif
-    return cols;
-}
 
 void Platform::remove_console() {
 #ifdef _WIN32
@@ -26,7 +26,6 @@ public:
     bool is_down(SDL_Scancode key);
 
     static void remove_console();
-    static int console_width();
     static void strcpy(char* dest, const char* src, size_t limit);
 
 private:
@@ -0,0 +1,181 @@
+
+#include "socket.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#define poll WSAPoll
+using socklen_t = int;
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#ifdef _WIN32
+const Socket::Handle Socket::invalid = INVALID_SOCKET;
+
+// Winsock must be initialized once before any socket is created
+static bool startup() {
+    static bool ok = [] {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    return ok;
+}
+#else
+const Socket::Handle Socket::invalid = -1;
+
+static bool startup() {
+    return true;
+}
+#endif
+
+Socket::Socket(Socket&& src) : handle(src.handle) {
+    src.handle = invalid;
+}
+
+Socket::~Socket() {
+    close();
+}
+
+Socket& Socket::operator=(Socket&& src) {
+    if(this != &src) {
+        close();
+        handle = src.handle;
+        src.handle = invalid;
+    }
+    return *this;
+}
+
+void Socket::configure(Handle handle) {
+    // Messages are sent whole, so don't wait to coalesce them
+    int yes = 1;
+    setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (const char*)&yes, sizeof(yes));
+#ifdef SO_NOSIGPIPE
+    setsockopt(handle, SOL_SOCKET, SO_NOSIGPIPE, (const char*)&yes, sizeof(yes));
+#endif
+}
+
+bool Socket::valid() const {
+    return handle != invalid;
+}
+
+void Socket::close() {
+    if(!valid()) return;
+#ifdef _WIN32
+    closesocket(handle);
+#else
+    ::close(handle);
+#endif
+    handle = invalid;
+}
+
+std::string Socket::listen(uint16_t port) {
+
+    close();
+    if(!startup()) return "Failed to initialize sockets.";
+
+    handle = ::socket(AF_INET, SOCK_STREAM, 0);
+    if(!valid()) return "Failed to create socket.";
+
+    // Let a restarted coordinator reuse the port right away
+    int yes = 1;
+    setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(yes));
+
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if(::bind(handle, (const sockaddr*)&addr, sizeof(addr)) != 0) {
+        close();
+        return "Failed to bind port " + std::to_string(port) + ".";
+    }
+    if(::listen(handle, SOMAXCONN) != 0) {
+        close();
+        return "Failed to listen on port " + std::to_string(port) + ".";
+    }
+    return {};
+}
+
+std::string Socket::connect(std::string host, uint16_t port) {
+
+    close();
+    if(!startup()) return "Failed to initialize sockets.";
+
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* addrs = nullptr;
+    std::string service = std::to_string(port);
+    if(getaddrinfo(host.c_str(), service.c_str(), &hints, &addrs) != 0 || !addrs) {
+        return "Failed to resolve " + host + ".";
+    }
+
+    for(addrinfo* a = addrs; a; a = a->ai_next) {
+        handle = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if(!valid()) continue;
+        if(::connect(handle, a->ai_addr, (socklen_t)a->ai_addrlen) == 0) break;
+        close();
+    }
+    freeaddrinfo(addrs);
+
+    if(!valid()) return "Failed to connect to " + host + ":" + service + ".";
+    configure(handle);
+    return {};
+}
+
+Socket Socket::accept(int timeout_ms) {
+
+    Socket ret;
+    if(!valid()) return ret;
+
+    pollfd fd;
+    fd.fd = handle;
+    fd.events = POLLIN;
+    fd.revents = 0;
+    if(poll(&fd, 1, timeout_ms) <= 0) return ret;
+
+    ret.handle = ::accept(handle, nullptr, nullptr);
+    if(ret.valid()) configure(ret.handle);
+    return ret;
+}
+
+bool Socket::send(const void* data, size_t size) {
+    const char* bytes = (const char*)data;
+    while(size > 0) {
+        int chunk = (int)std::min(size, size_t(1) << 30);
+        // Writing to a closed connection must fail, not raise SIGPIPE
+        int sent = (int)::send(handle, bytes, chunk, MSG_NOSIGNAL);
+        if(sent <= 0) return false;
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+bool Socket::recv(void* data, size_t size) {
+    char* bytes = (char*)data;
+    while(size > 0) {
+        int chunk = (int)std::min(size, size_t(1) << 30);
+        int got = (int)::recv(handle, bytes, chunk, 0);
+        if(got <= 0) return false;
+        bytes += got;
+        size -= got;
+    }
+    return true;
+}
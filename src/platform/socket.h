@@ -0,0 +1,46 @@
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// A blocking TCP connection, or a listening socket that accepts them. Used by distributed
+// renders, so a coordinator can hand out work to workers on the same machine or across a
+// network. Errors are returned as messages, empty on success.
+class Socket {
+public:
+    Socket() = default;
+    Socket(const Socket& src) = delete;
+    Socket(Socket&& src);
+    ~Socket();
+
+    Socket& operator=(const Socket& src) = delete;
+    Socket& operator=(Socket&& src);
+
+    /// Listen for connections on port, on every interface
+    std::string listen(uint16_t port);
+    /// Connect to a listening socket at host:port
+    std::string connect(std::string host, uint16_t port);
+    /// Wait up to timeout_ms for an incoming connection. The returned socket is invalid if
+    /// none arrived.
+    Socket accept(int timeout_ms);
+
+    /// Send or receive exactly size bytes. Fails if the connection closes first.
+    bool send(const void* data, size_t size);
+    bool recv(void* data, size_t size);
+
+    bool valid() const;
+    void close();
+
+private:
+#ifdef _WIN32
+    using Handle = uintptr_t;
+#else
+    using Handle = int;
+#endif
+    static const Handle invalid;
+    // Set the options of a connected socket
+    static void configure(Handle handle);
+    Handle handle = invalid;
+};
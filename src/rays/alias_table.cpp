@@ -0,0 +1,134 @@
+
+#include "alias_table.h"
+#include "../util/rand.h"
+
+namespace Samplers {
+
+Alias_Table::Alias_Table(const float* weights, size_t n) {
+
+    slots.resize(n);
+    probs.resize(n);
+
+    double total = 0.0;
+    for(size_t i = 0; i < n; i++) total += std::max(weights[i], 0.0f);
+
+    // Scale the probabilities so that the average slot holds exactly 1. Slots below 1
+    // are topped up by an alias from a slot above 1, which donates the difference.
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> small, large;
+    small.reserve(n);
+    large.reserve(n);
+    for(size_t i = 0; i < n; i++) {
+        double p = total > 0.0 ? std::max(weights[i], 0.0f) / total : 1.0 / n;
+        probs[i] = (float)p;
+        scaled[i] = p * n;
+        if(scaled[i] < 1.0) {
+            small.push_back((uint32_t)i);
+        } else {
+            large.push_back((uint32_t)i);
+        }
+    }
+
+    while(!small.empty() && !large.empty()) {
+        uint32_t s = small.back(), l = large.back();
+        small.pop_back();
+        large.pop_back();
+        slots[s] = {(float)scaled[s], l};
+        scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+        if(scaled[l] < 1.0) {
+            small.push_back(l);
+        } else {
+            large.push_back(l);
+        }
+    }
+
+    // Whatever is left is 1 up to rounding error
+    for(uint32_t i : large) slots[i] = {1.0f, i};
+    for(uint32_t i : small) slots[i] = {1.0f, i};
+}
+
+size_t Alias_Table::sample(float u, float& rest) const {
+    size_t n = slots.size();
+    float x = u * n;
+    size_t i = std::min((size_t)x, n - 1);
+    // u * n rounds up to n for u just below 1 once n is large. Keeping f below 1 means
+    // slots with a threshold of 1 always return themselves, never dividing 0 by 0.
+    float f = std::min(x - i, 1.0f - FLT_EPSILON);
+    const Slot& slot = slots[i];
+    if(f < slot.threshold) {
+        rest = f / slot.threshold;
+        return i;
+    }
+    rest = std::min((f - slot.threshold) / (1.0f - slot.threshold), 1.0f - FLT_EPSILON);
+    return slot.alias;
+}
+
+namespace Sphere {
+
+Image_Alias::Image_Alias(const std::vector<float>& luma, size_t w, size_t h, Thread_Pool* pool)
+    : w(w), h(h) {
+
+    // Rows near the poles cover less solid angle, so texels are weighted by sin(theta)
+    std::vector<float> row_weights(h);
+    columns.resize(h);
+
+    auto build_rows = [&](size_t begin, size_t end) {
+        std::vector<float> weights(w);
+        for(size_t y = begin; y < end; y++) {
+            float theta = PI_F * (1.0f - ((float)y + 0.5f) / h);
+            float s = std::sin(theta), sum = 0.0f;
+            for(size_t x = 0; x < w; x++) {
+                weights[x] = luma[y * w + x] * s;
+                sum += weights[x];
+            }
+            row_weights[y] = sum;
+            columns[y] = Alias_Table(weights.data(), w);
+        }
+    };
+
+    if(pool && h > 1) {
+        size_t chunk = std::max(size_t(16), h / (4 * pool->size() + 1));
+        std::vector<std::future<void>> jobs;
+        for(size_t y = 0; y < h; y += chunk) {
+            jobs.push_back(pool->enqueue(build_rows, y, std::min(y + chunk, h)));
+        }
+        for(auto& job : jobs) pool->wait_on(job);
+    } else {
+        build_rows(0, h);
+    }
+
+    rows = Alias_Table(row_weights.data(), h);
+}
+
+Vec3 Image_Alias::sample() const {
+
+    Vec2 xi = RNG::unit2();
+    float v, u;
+    size_t y = rows.sample(xi.y, v);
+    size_t x = columns[y].sample(xi.x, u);
+
+    // Uniform in (phi, theta) within the texel
+    float phi = 2.0f * PI_F * ((float)x + u) / w;
+    float theta = PI_F * (1.0f - ((float)y + v) / h);
+    float sin_t = std::sin(theta);
+    return Vec3(sin_t * std::cos(phi), std::cos(theta), sin_t * std::sin(phi));
+}
+
+float Image_Alias::pdf(Vec3 dir) const {
+
+    float theta = std::acos(clamp(dir.y, -1.0f, 1.0f));
+    float phi = std::atan2(dir.z, dir.x);
+    if(phi < 0.0f) phi += 2.0f * PI_F;
+
+    size_t x = std::min((size_t)(phi / (2.0f * PI_F) * w), w - 1);
+    size_t y = std::min((size_t)((1.0f - theta / PI_F) * h), h - 1);
+
+    // Texel probability over the texel's solid angle, dphi dtheta sin(theta). Samples
+    // can land exactly on a pole, where the density is unbounded.
+    float sin_t = std::max(std::sin(theta), FLT_EPSILON);
+    float p = rows.probability(y) * columns[y].probability(x);
+    return p * w * h / (2.0f * PI_F * PI_F * sin_t);
+}
+
+} // namespace Sphere
+} // namespace Samplers
@@ -0,0 +1,62 @@
+
+#pragma once
+
+#include "../lib/mathlib.h"
+#include "../util/thread_pool.h"
+
+#include <vector>
+
+namespace Samplers {
+
+// Vose's alias method: after O(n) setup, draws an index from a discrete distribution with
+// one table lookup, no matter how many entries there are. Each slot holds a threshold and
+// an alias; a uniform number picks the slot, and its fractional part picks between the
+// slot itself and its alias.
+class Alias_Table {
+public:
+    Alias_Table() = default;
+    Alias_Table(const float* weights, size_t n);
+
+    /// Draw an index using u in [0,1). rest is set to a fresh uniform number in [0,1)
+    /// derived from the unused bits of u.
+    size_t sample(float u, float& rest) const;
+    /// Probability of drawing index i
+    float probability(size_t i) const {
+        return probs[i];
+    }
+    size_t size() const {
+        return probs.size();
+    }
+
+private:
+    // Sampling only reads one slot, so the threshold and alias share a cache line
+    struct Slot {
+        float threshold;
+        uint32_t alias;
+    };
+    std::vector<Slot> slots;
+    std::vector<float> probs;
+};
+
+namespace Sphere {
+
+// Importance samples directions proportionally to the luminance of a latitude-longitude
+// image, using a marginal table over rows and a conditional table per row. Texel (x, y)
+// covers phi in [2pi x / w, 2pi (x + 1) / w) and theta (from +y) in
+// [pi (1 - (y + 1) / h), pi (1 - y / h)), i.e. row 0 is the bottom of the image.
+struct Image_Alias {
+    Image_Alias() = default;
+    /// Build from the luminance of each texel, row by row. Rows are set up in parallel if
+    /// a pool is given.
+    Image_Alias(const std::vector<float>& luma, size_t w, size_t h, Thread_Pool* pool = nullptr);
+
+    Vec3 sample() const;
+    float pdf(Vec3 dir) const;
+
+    size_t w = 0, h = 0;
+    Alias_Table rows;
+    std::vector<Alias_Table> columns;
+};
+
+} // namespace Sphere
+} // namespace Samplers
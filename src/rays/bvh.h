@@ -4,15 +4,55 @@
 #include "../lib/mathlib.h"
 #include "../platform/gl.h"
 
+#include "packet.h"
 #include "trace.h"
 
+#include <cstdint>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// Branching factor of the BVH used for traversal. Binary BVHs are always built first;
+// with a width of 4 (SSE) or 8 (AVX2) they are then collapsed into wide nodes whose
+// children are all tested with one vectorized slab test.
+#ifndef SCOTTY3D_BVH_WIDTH
+#define SCOTTY3D_BVH_WIDTH 4
+#endif
+
+class Thread_Pool;
+
 namespace PT {
 
+struct BVH_Options {
+    /// Nodes with at most this many primitives may become leaves
+    size_t max_leaf_size = 1;
+    /// Number of centroid bins evaluated per axis when choosing a split
+    size_t bins = 16;
+    /// Relative SAH costs of visiting an interior node and intersecting a primitive
+    float traversal_cost = 1.0f;
+    float intersection_cost = 1.0f;
+    /// refit() rebuilds the BVH once its SAH cost exceeds this multiple of the built cost
+    float refit_rebuild_ratio = 1.5f;
+    /// If set, large subtrees near the root are built as tasks on this pool
+    Thread_Pool* pool = nullptr;
+};
+
+struct BVH_Stats {
+    /// Wall-clock build time in seconds
+    float build_time = 0.0f;
+    /// Expected cost of a random ray under the surface area heuristic
+    float sah_cost = 0.0f;
+    size_t nodes = 0, leaves = 0, primitives = 0;
+};
+
 template<typename Primitive> class BVH {
 public:
     BVH() = default;
     BVH(std::vector<Primitive>&& primitives, size_t max_leaf_size = 1);
+    BVH(std::vector<Primitive>&& primitives, const BVH_Options& opt);
     void build(std::vector<Primitive>&& primitives, size_t max_leaf_size = 1);
+    void build(std::vector<Primitive>&& primitives, const BVH_Options& opt);
 
     BVH(BVH&& src) = default;
     BVH& operator=(BVH&& src) = default;
@@ -21,7 +61,18 @@ public:
     BVH& operator=(const BVH& src) = delete;
 
     BBox bbox() const;
-    Trace hit(const Ray& ray) const;
+    Hit hit(const Ray& ray) const;
+    void hit(const Ray_Packet& packet, unsigned int mask, Hit* ret) const;
+    /// Whether anything lies along ray within its dist_bounds. Stops at the first hit found.
+    bool occluded(const Ray& ray) const;
+    /// Calls f(primitive) for every primitive in a leaf that ray passes through within its
+    /// dist_bounds, in no particular order. f must test the primitive itself.
+    template<typename F> void visit(const Ray& ray, F&& f) const;
+
+    /// Update the bounds after primitives moved, keeping the tree structure. If this
+    /// degrades the tree too much (see BVH_Options::refit_rebuild_ratio) it is rebuilt
+    /// instead, using the pool if given. Returns false if the BVH was rebuilt.
+    bool refit(Thread_Pool* pool = nullptr);
 
     BVH copy() const;
     size_t visualize(GL::Lines& lines, GL::Lines& active, size_t level, const Mat4& trans) const;
@@ -29,21 +80,83 @@ public:
     std::vector<Primitive> destructure();
     void clear();
 
+    const BVH_Stats& stats() const {
+        return build_stats;
+    }
+
+    /// Primitives in leaf order. They may be modified in place as long as their
+    /// bounding boxes don't change.
+    std::vector<Primitive>& leaf_primitives() {
+        return primitives;
+    }
+
 private:
+    // Nodes are stored in depth-first order, so an interior node's first child directly
+    // follows it and only the index of the second child is stored in `offset`. For a
+    // leaf, `offset` is the index of its first primitive and `size` (non-zero) is the
+    // number of primitives. This keeps each node at 32 bytes.
     class Node {
 
         BBox bbox;
-        size_t start, size, l, r;
+        uint32_t offset, size;
 
-        // A node is a leaf if l == r, since all interior nodes must have distinct children
+        // A node is a leaf if it contains primitives; interior nodes have size == 0
         bool is_leaf() const;
         friend class BVH<Primitive>;
     };
-    size_t new_node(BBox box = {}, size_t start = 0, size_t size = 0, size_t l = 0, size_t r = 0);
+    static_assert(sizeof(Node) == 32);
+
+    // Traversal uses a fixed-size stack; the builder switches to median splits past
+    // max_sah_depth so that no tree is deeper than max_depth.
+    static constexpr size_t max_depth = 64;
+    static constexpr size_t max_sah_depth = 32;
+    // Subtrees with at least this many primitives are built as separate pool tasks
+    static constexpr size_t parallel_build_size = 4096;
+
+    // Primitive bounds cached for the duration of a build
+    struct Build_Ref {
+        BBox box;
+        Vec3 center;
+        size_t idx;
+    };
+    static size_t build_range(std::vector<Node>& out, std::vector<Build_Ref>& refs, size_t start,
+                              size_t end, const BVH_Options& opt, size_t depth);
+    void compute_stats(const BVH_Options& opt);
+    // SAH cost of the tree used for traversal, relative to the root's surface area
+    float sah_cost() const;
+    BBox leaf_bbox(uint32_t start, uint32_t size) const;
+
+#if SCOTTY3D_BVH_WIDTH > 2
+    static constexpr size_t width = SCOTTY3D_BVH_WIDTH;
+
+    // Child boxes are stored SoA (bounds[0..2] are min x/y/z, bounds[3..5] are max
+    // x/y/z). A child with size > 0 is a leaf holding primitives [child, child + size);
+    // otherwise child is the index of another wide node. Unused slots have empty boxes,
+    // which never pass the slab test.
+    struct alignas(32) Wide_Node {
+        float bounds[6][width];
+        uint32_t child[width], size[width];
+    };
+    static constexpr uint32_t empty_slot = UINT32_MAX;
+
+    void collapse();
+    uint32_t collapse_node(size_t idx);
+    static BBox wide_bbox(const Wide_Node& node);
+    static BBox slot_bbox(const Wide_Node& node, size_t i);
+    static unsigned int hit_children(const Wide_Node& node, const Ray& ray, const Vec3& inv,
+                                     float* tmin);
+
+    std::vector<Wide_Node> wide_nodes;
+#endif
 
     std::vector<Node> nodes;
     std::vector<Primitive> primitives;
     size_t root_idx = 0;
+    BVH_Stats build_stats;
+
+    // Kept for refit(): the options the tree was built with and its SAH cost at the time
+    BVH_Options options;
+    float built_cost = 0.0f;
 };
 
 } // namespace PT
@@ -7,6 +7,7 @@
 #include "../lib/spectrum.h"
 #include "../util/hdr_image.h"
 
+#include "alias_table.h"
 #include "light.h"
 #include "samplers.h"
 
@@ -40,8 +41,7 @@ struct Env_Sphere {
 
 struct Env_Map {
 
-    Env_Map(HDR_Image&& img) : image(std::move(img)), image_sampler(image) {
-    }
+    Env_Map(HDR_Image&& img, Thread_Pool* pool = nullptr);
 
     Vec3 sample() const;
     Spectrum evaluate(Vec3 dir) const;
@@ -50,6 +50,8 @@ struct Env_Map {
     HDR_Image image;
     Samplers::Sphere::Uniform uniform_sampler;
     Samplers::Sphere::Image image_sampler;
+    // Constant-time importance sampling by luminance, for large maps
+    Samplers::Sphere::Image_Alias alias_sampler;
 };
 
 class Env_Light {
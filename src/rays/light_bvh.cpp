@@ -0,0 +1,354 @@
+
+#include "light_bvh.h"
+
+#include "../util/rand.h"
+
+namespace PT {
+
+static float safe_acos(float x) {
+    return std::acos(clamp(x, -1.0f, 1.0f));
+}
+
+static float safe_sqrt(float x) {
+    return std::sqrt(std::max(x, 0.0f));
+}
+
+Light_Bounds Light_Bounds::point(Vec3 pos, float power) {
+    Light_Bounds ret;
+    ret.box.enclose(pos);
+    ret.axis = Vec3(0.0f, 1.0f, 0.0f);
+    ret.power = power;
+    ret.cos_o = -1.0f;
+    ret.cos_e = 0.0f;
+    return ret;
+}
+
+Light_Bounds Light_Bounds::spot(Vec3 pos, Vec3 dir, float cos_e, float power) {
+    Light_Bounds ret;
+    ret.box.enclose(pos);
+    ret.axis = dir.unit();
+    ret.power = power;
+    ret.cos_o = 1.0f;
+    ret.cos_e = cos_e;
+    return ret;
+}
+
+Light_Bounds Light_Bounds::surface(const BBox& box, float power) {
+    Light_Bounds ret;
+    ret.box = box;
+    ret.axis = Vec3(0.0f, 1.0f, 0.0f);
+    ret.power = power;
+    ret.cos_o = -1.0f;
+    ret.cos_e = 0.0f;
+    ret.two_sided = true;
+    return ret;
+}
+
+Light_Bounds Light_Bounds::merge(const Light_Bounds& a, const Light_Bounds& b) {
+
+    if(a.box.empty()) return b;
+    if(b.box.empty()) return a;
+
+    Light_Bounds ret;
+    ret.box = a.box;
+    ret.box.enclose(b.box);
+    ret.power = a.power + b.power;
+    ret.cos_e = std::min(a.cos_e, b.cos_e);
+    ret.two_sided = a.two_sided || b.two_sided;
+
+    // Smallest cone containing both normal cones: if neither contains the other, its
+    // axis is a's axis rotated towards b's, and it spans from a's far edge to b's.
+    float theta_a = safe_acos(a.cos_o), theta_b = safe_acos(b.cos_o);
+    float theta_d = safe_acos(dot(a.axis, b.axis));
+
+    if(std::min(theta_d + theta_b, PI_F) <= theta_a) {
+        ret.axis = a.axis;
+        ret.cos_o = a.cos_o;
+        return ret;
+    }
+    if(std::min(theta_d + theta_a, PI_F) <= theta_b) {
+        ret.axis = b.axis;
+        ret.cos_o = b.cos_o;
+        return ret;
+    }
+
+    float theta_o = 0.5f * (theta_a + theta_d + theta_b);
+    Vec3 normal = cross(a.axis, b.axis);
+    if(theta_o >= PI_F || normal.norm_squared() == 0.0f) {
+        ret.axis = a.axis;
+        ret.cos_o = -1.0f;
+        return ret;
+    }
+
+    float theta_r = theta_o - theta_a;
+    normal.normalize();
+    ret.axis = (a.axis * std::cos(theta_r) + cross(normal, a.axis) * std::sin(theta_r)).unit();
+    ret.cos_o = std::cos(theta_o);
+    return ret;
+}
+
+float Light_Bounds::importance(Vec3 from) const {
+
+    if(power <= 0.0f || box.empty()) return 0.0f;
+
+    // Squared distance to the center, kept from collapsing when the point is inside or
+    // close to the bounds
+    Vec3 to = from - box.center();
+    float radius = 0.5f * (box.max - box.min).norm();
+    float dist2 = to.norm_squared();
+    float d2 = std::max(std::max(dist2, radius * radius), EPS_F);
+
+    // Angle between the axis and the direction to the point...
+    float cos_w = dist2 > 0.0f ? dot(axis, to) / std::sqrt(dist2) : 1.0f;
+    if(two_sided) cos_w = std::abs(cos_w);
+    float sin_w = safe_sqrt(1.0f - cos_w * cos_w);
+
+    // ...minus the spread of the normals...
+    float cos_x = 1.0f, sin_x = 0.0f;
+    if(cos_w < cos_o) {
+        float sin_o = safe_sqrt(1.0f - cos_o * cos_o);
+        cos_x = cos_w * cos_o + sin_w * sin_o;
+        sin_x = sin_w * cos_o - cos_w * sin_o;
+    }
+
+    // ...minus the angle the bounds subtend at the point. What remains is the smallest
+    // angle any emitter's normal can make with the direction towards the point.
+    float cos_b = -1.0f;
+    if(dist2 > radius * radius) cos_b = safe_sqrt(1.0f - radius * radius / dist2);
+    float cos_p = 1.0f;
+    if(cos_x < cos_b) {
+        float sin_b = safe_sqrt(1.0f - cos_b * cos_b);
+        cos_p = cos_x * cos_b + sin_x * sin_b;
+    }
+
+    if(cos_p <= cos_e) return 0.0f;
+    return power * cos_p / d2;
+}
+
+// Measure of the directions the lights emit into, which the build weighs clusters by
+static float orientation_measure(const Light_Bounds& b) {
+    float theta_o = safe_acos(b.cos_o), theta_e = safe_acos(b.cos_e);
+    float theta_w = std::min(theta_o + theta_e, PI_F);
+    float sin_o = std::sin(theta_o);
+    return 2.0f * PI_F * (1.0f - b.cos_o) +
+           0.5f * PI_F *
+               (2.0f * theta_w * sin_o - std::cos(theta_o - 2.0f * theta_w) -
+                2.0f * theta_o * sin_o + b.cos_o);
+}
+
+static float cluster_cost(const Light_Bounds& b) {
+    if(b.box.empty()) return 0.0f;
+    return b.power * orientation_measure(b) * b.box.surface_area();
+}
+
+Light_BVH::Light_BVH(std::vector<Light_Bounds> lights) {
+    build(std::move(lights));
+}
+
+void Light_BVH::clear() {
+    nodes.clear();
+    trails.clear();
+}
+
+void Light_BVH::build(std::vector<Light_Bounds> lights) {
+
+    clear();
+    if(lights.empty()) return;
+
+    std::vector<unsigned int> order(lights.size());
+    for(size_t i = 0; i < lights.size(); i++) order[i] = (unsigned int)i;
+
+    nodes.reserve(2 * lights.size() - 1);
+    trails.resize(lights.size());
+    build(order, 0, order.size(), 0, 0, lights);
+}
+
+unsigned int Light_BVH::build(std::vector<unsigned int>& order, size_t begin, size_t end,
+                              size_t depth, uint64_t trail,
+                              const std::vector<Light_Bounds>& lights) {
+
+    unsigned int node = (unsigned int)nodes.size();
+    nodes.emplace_back();
+
+    if(end - begin == 1) {
+        unsigned int light = order[begin];
+        nodes[node].bounds = lights[light];
+        nodes[node].index = light;
+        nodes[node].leaf = true;
+        trails[light] = trail;
+        return node;
+    }
+
+    Light_Bounds total;
+    BBox centroids;
+    for(size_t i = begin; i < end; i++) {
+        total = Light_Bounds::merge(total, lights[order[i]]);
+        centroids.enclose(lights[order[i]].box.center());
+    }
+
+    Vec3 extent = centroids.max - centroids.min;
+    int axis = 0;
+    if(extent.y > extent[axis]) axis = 1;
+    if(extent.z > extent[axis]) axis = 2;
+
+    // Bucketed split minimizing the summed cost of the children, i.e. their power weighted
+    // by the size of their bounds and the spread of their emission. Splits across a thin
+    // axis of the bounds are penalized, since they separate lights that look alike.
+    constexpr size_t n_buckets = 12;
+    auto bucket = [&](unsigned int light, int a) {
+        float t = (lights[light].box.center()[a] - centroids.min[a]) / extent[a];
+        return std::min(n_buckets - 1, (size_t)(n_buckets * t));
+    };
+
+    size_t mid = begin;
+    if(depth < max_split_depth) {
+
+        Vec3 diagonal = total.box.max - total.box.min;
+        float longest = std::max(diagonal.x, std::max(diagonal.y, diagonal.z));
+        float best_cost = FLT_MAX;
+        int best_axis = -1;
+        size_t best_split = 0;
+
+        for(int a = 0; a < 3; a++) {
+            if(extent[a] <= 0.0f) continue;
+
+            Light_Bounds buckets[n_buckets];
+            for(size_t i = begin; i < end; i++) {
+                size_t b = bucket(order[i], a);
+                buckets[b] = Light_Bounds::merge(buckets[b], lights[order[i]]);
+            }
+
+            Light_Bounds right[n_buckets];
+            right[n_buckets - 1] = buckets[n_buckets - 1];
+            for(size_t b = n_buckets - 1; b > 0; b--) {
+                right[b - 1] = Light_Bounds::merge(buckets[b - 1], right[b]);
+            }
+
+            float regularize = longest / diagonal[a];
+            Light_Bounds left;
+            for(size_t s = 1; s < n_buckets; s++) {
+                left = Light_Bounds::merge(left, buckets[s - 1]);
+                float cost = regularize * (cluster_cost(left) + cluster_cost(right[s]));
+                if(cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = a;
+                    best_split = s;
+                }
+            }
+        }
+
+        if(best_axis >= 0) {
+            auto split = std::partition(order.begin() + begin, order.begin() + end,
+                                        [&](unsigned int light) {
+                                            return bucket(light, best_axis) < best_split;
+                                        });
+            mid = split - order.begin();
+        }
+    }
+
+    // Coincident centroids or an unbalanced tree: split evenly
+    if(mid == begin || mid == end) {
+        mid = (begin + end) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                         [&](unsigned int l, unsigned int r) {
+                             return lights[l].box.center()[axis] < lights[r].box.center()[axis];
+                         });
+    }
+
+    build(order, begin, mid, depth + 1, trail, lights);
+    unsigned int second = build(order, mid, end, depth + 1, trail | (uint64_t(1) << depth), lights);
+
+    nodes[node].bounds = total;
+    nodes[node].index = second;
+    return node;
+}
+
+size_t Light_BVH::sample(Vec3 from, float u, float& pmf) const {
+
+    pmf = 1.0f;
+    unsigned int n = 0;
+
+    // Each choice reuses u: rescaled to [0,1) within the chosen interval, it stays uniform
+    while(!nodes[n].leaf) {
+        unsigned int a = n + 1, b = nodes[n].index;
+        float p = split(nodes[a].bounds.importance(from), nodes[b].bounds.importance(from));
+        if(u < p) {
+            u = std::min(u / p, 1.0f - FLT_EPSILON);
+            pmf *= p;
+            n = a;
+        } else {
+            u = std::min((u - p) / (1.0f - p), 1.0f - FLT_EPSILON);
+            pmf *= 1.0f - p;
+            n = b;
+        }
+    }
+    return nodes[n].index;
+}
+
+float Light_BVH::pmf(Vec3 from, size_t light) const {
+
+    float pmf = 1.0f;
+    unsigned int n = 0;
+    uint64_t trail = trails[light];
+
+    while(!nodes[n].leaf) {
+        unsigned int a = n + 1, b = nodes[n].index;
+        float p = split(nodes[a].bounds.importance(from), nodes[b].bounds.importance(from));
+        if(trail & 1) {
+            pmf *= 1.0f - p;
+            n = b;
+        } else {
+            pmf *= p;
+            n = a;
+        }
+        trail >>= 1;
+    }
+    return pmf;
+}
+
+void Area_Lights::add(Mesh mesh, const Mat4& T, Spectrum radiance) {
+
+    float luma = radiance.luma();
+    if(luma <= 0.0f || !(mesh->area() > 0.0f)) return;
+
+    // A diffuse emitter sends pi * radiance * area out of each face. The power only guides
+    // the light BVH, so scaled instances use the area scale of a uniform scale with the
+    // same volume change.
+    float area = mesh->area() * std::pow(std::abs(T.det()), 2.0f / 3.0f);
+    BBox box = mesh->bbox();
+    box.transform(T);
+
+    bounds.push_back(Light_Bounds::surface(box, 2.0f * PI_F * luma * area));
+    instances.push_back({std::move(mesh), T, T.inverse()});
+}
+
+void Area_Lights::build() {
+    bvh.build(std::move(bounds));
+    bounds.clear();
+}
+
+void Area_Lights::clear() {
+    instances.clear();
+    bounds.clear();
+    bvh.clear();
+}
+
+Vec3 Area_Lights::sample(Vec3 from) const {
+    float pmf;
+    const Instance& light = instances[bvh.sample(from, RNG::unit(), pmf)];
+    Vec3 dir = light.mesh->sample(light.iT * from);
+    return light.T.rotate(dir).unit();
+}
+
+float Area_Lights::pdf(const Ray& ray) const {
+
+    // Sum over every instance the ray passes through, as each could have produced it
+    float pdf = 0.0f;
+    bvh.intersect(ray, [&](size_t i, float pmf) {
+        const Instance& light = instances[i];
+        pdf += pmf * light.mesh->pdf(ray, light.T, light.iT);
+    });
+    return pdf;
+}
+
+} // namespace PT
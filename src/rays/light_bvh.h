@@ -0,0 +1,166 @@
+
+#pragma once
+
+#include "../lib/mathlib.h"
+#include "../lib/spectrum.h"
+
+#include "tri_mesh.h"
+
+#include <memory>
+#include <vector>
+
+namespace PT {
+
+// Conservative bounds on where a group of lights is and in which directions it emits:
+// every emitter lies in box, every emitting surface normal lies within the cone of
+// half-angle acos(cos_o) around axis, and light leaves each surface at most acos(cos_e)
+// away from its normal. Two-sided emitters also emit around -axis.
+struct Light_Bounds {
+
+    /// Bounds of an isotropic point emitter
+    static Light_Bounds point(Vec3 pos, float power);
+    /// Bounds of an emitter that illuminates the cone of half-angle acos(cos_e) about dir
+    static Light_Bounds spot(Vec3 pos, Vec3 dir, float cos_e, float power);
+    /// Bounds of diffuse surfaces of any orientation within box, emitting from both faces
+    static Light_Bounds surface(const BBox& box, float power);
+
+    /// Bounds enclosing both a and b
+    static Light_Bounds merge(const Light_Bounds& a, const Light_Bounds& b);
+
+    /// Upper bound on the contribution of these lights at a point, up to a constant factor.
+    /// Zero only if no light in the bounds can illuminate the point.
+    float importance(Vec3 from) const;
+
+    BBox box;
+    Vec3 axis;
+    float power = 0.0f;
+    float cos_o = 1.0f, cos_e = 1.0f;
+    bool two_sided = false;
+};
+
+// A binary hierarchy over lights that picks one in O(log n) with probability roughly
+// proportional to its contribution at the shading point (the bounding-cone light BVH of
+// Conty Estevez and Kulla). Each step down the tree chooses between the two children in
+// proportion to the importance of their bounds. The tree only selects light indices;
+// the owner samples the chosen light itself.
+class Light_BVH {
+public:
+    Light_BVH() = default;
+    explicit Light_BVH(std::vector<Light_Bounds> lights);
+
+    void build(std::vector<Light_Bounds> lights);
+    void clear();
+    bool empty() const {
+        return nodes.empty();
+    }
+
+    /// Choose a light to shade the point from, using u in [0,1). pmf is set to the
+    /// probability of the choice.
+    size_t sample(Vec3 from, float u, float& pmf) const;
+    /// Probability that sample(from, ...) chooses light
+    float pmf(Vec3 from, size_t light) const;
+
+    /// Calls f(light, pmf) for every light whose bounding box the ray crosses, where pmf is
+    /// the probability of sample(ray.point, ...) choosing that light.
+    template<typename F> void intersect(const Ray& ray, F&& f) const;
+
+private:
+    struct Node {
+        Light_Bounds bounds;
+        // Interior nodes are followed by their first child and store the index of the
+        // second; leaves store the index of their light.
+        unsigned int index = 0;
+        bool leaf = false;
+    };
+
+    // Probability of descending into the first of two children
+    static float split(float first, float second) {
+        float total = first + second;
+        return total > 0.0f ? first / total : 0.5f;
+    }
+
+    unsigned int build(std::vector<unsigned int>& order, size_t begin, size_t end, size_t depth,
+                       uint64_t trail, const std::vector<Light_Bounds>& lights);
+
+    // Trails limit the depth of the tree; nodes deeper than max_split_depth split at the
+    // median, so that even degenerate sets of lights stay within it.
+    static constexpr size_t max_depth = 64, max_split_depth = 32;
+
+    std::vector<Node> nodes;
+    // For each light, the choices leading to its leaf: bit i is set if the second child
+    // was taken at depth i.
+    std::vector<uint64_t> trails;
+};
+
+template<typename F> void Light_BVH::intersect(const Ray& ray, F&& f) const {
+
+    if(nodes.empty()) return;
+
+    struct Entry {
+        unsigned int node;
+        float pmf;
+    };
+    Entry stack[max_depth + 1];
+    size_t top = 0;
+    stack[top++] = {0, 1.0f};
+
+    while(top) {
+        Entry e = stack[--top];
+        const Node& node = nodes[e.node];
+
+        Vec2 times = ray.dist_bounds;
+        if(!node.bounds.box.hit(ray, times)) continue;
+
+        if(node.leaf) {
+            f((size_t)node.index, e.pmf);
+            continue;
+        }
+
+        unsigned int a = e.node + 1, b = node.index;
+        float p = split(nodes[a].bounds.importance(ray.point),
+                        nodes[b].bounds.importance(ray.point));
+        if(p < 1.0f) stack[top++] = {b, e.pmf * (1.0f - p)};
+        if(p > 0.0f) stack[top++] = {a, e.pmf * p};
+    }
+}
+
+// Every emissive mesh instance of the scene, sampled through a light BVH. The instances
+// share the meshes the scene is traced with, so emissive geometry is not copied into world
+// space: the BVH chooses an instance, and the mesh then chooses a triangle by area and
+// evaluates pdfs through its own BVH.
+class Area_Lights {
+public:
+    using Mesh = std::shared_ptr<const Tri_Mesh>;
+
+    /// Add an instance of mesh, transformed by T, emitting radiance. The mesh must have
+    /// been prepared for sampling.
+    void add(Mesh mesh, const Mat4& T, Spectrum radiance);
+    /// Build the light BVH over the added instances
+    void build();
+    void clear();
+
+    bool empty() const {
+        return instances.empty();
+    }
+    size_t size() const {
+        return instances.size();
+    }
+
+    /// Sample a direction from a point towards an emissive surface
+    Vec3 sample(Vec3 from) const;
+    /// Solid angle density of sample(ray.point) producing ray.dir
+    float pdf(const Ray& ray) const;
+
+private:
+    struct Instance {
+        Mesh mesh;
+        Mat4 T, iT;
+    };
+
+    std::vector<Instance> instances;
+    // Bounds of the instances added since the last build
+    std::vector<Light_Bounds> bounds;
+    Light_BVH bvh;
+};
+
+} // namespace PT
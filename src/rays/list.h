@@ -3,6 +3,7 @@
 
 #include "../lib/mathlib.h"
 #include "../util/rand.h"
+#include "packet.h"
 #include "trace.h"
 
 namespace PT {
@@ -22,15 +23,28 @@ public:
         return ret;
     }
 
-    Trace hit(const Ray& ray) const {
-        Trace ret;
+    Hit hit(const Ray& ray) const {
+        Hit ret;
         for(const auto& p : prims) {
-            Trace test = p.hit(ray);
-            ret = Trace::min(ret, test);
+            Hit test = p.hit(ray);
+            ret = Hit::min(ret, test);
         }
         return ret;
     }
 
+    void hit(const Ray_Packet& packet, unsigned int mask, Hit* ret) const {
+        for(const auto& p : prims) {
+            p.hit(packet, mask, ret);
+        }
+    }
+
+    bool occluded(const Ray& ray) const {
+        for(const auto& p : prims) {
+            if(p.occluded(ray)) return true;
+        }
+        return false;
+    }
+
     void append(Primitive&& prim) {
         prims.push_back(std::move(prim));
     }
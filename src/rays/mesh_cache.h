@@ -0,0 +1,89 @@
+
+#pragma once
+
+#include "../scene/object.h"
+#include "tri_mesh.h"
+
+#include <memory>
+#include <unordered_map>
+
+namespace PT {
+
+// Mesh BVHs kept alive between scene builds. Entries are keyed on the Scene_ID of the
+// item that owns the mesh and the geometry version it was built from, so a rebuild where
+// only transforms (or materials, lights, etc.) changed reuses every mesh BVH and only
+// pays for the top-level BVH over the objects. Meshes whose vertices moved but whose
+// connectivity did not (e.g. skinned meshes between frames) can be refit in place.
+class Mesh_Cache {
+public:
+    using Mesh = std::shared_ptr<Tri_Mesh>;
+    using Instance = std::shared_ptr<const Tri_Mesh>;
+
+    struct Key {
+        Scene_ID id = 0;
+        /// Version of the vertex data, and of the connectivity between vertices
+        unsigned int version = 0, topology = 0;
+        bool use_bvh = true;
+    };
+
+    /// Returns the mesh built for this item, or null if its geometry has changed since
+    Mesh find(const Key& key) {
+        Entry* e = lookup(key);
+        if(!e || e->key.version != key.version) return nullptr;
+        e->used = true;
+        return e->mesh;
+    }
+
+    /// Returns the mesh built for this item if it may be refit to the current geometry:
+    /// only the vertices changed, and no other item shares the mesh. The caller must
+    /// refit it and store it under the new key.
+    Mesh find_refit(const Key& key) {
+        Entry* e = lookup(key);
+        if(!e || e->key.topology != key.topology || e->shared) return nullptr;
+        e->used = true;
+        return e->mesh;
+    }
+
+    /// Remembers the mesh built for this item at this geometry version
+    void store(const Key& key, Mesh mesh) {
+        entries[key.id] = {key, true, false, std::move(mesh)};
+    }
+
+    /// Drops every entry that was not found or stored since the previous prune,
+    /// i.e. meshes belonging to items that were deleted or changed geometry.
+    void prune() {
+        std::unordered_map<const Tri_Mesh*, size_t> users;
+        for(auto entry = entries.begin(); entry != entries.end();) {
+            if(!entry->second.used) {
+                entry = entries.erase(entry);
+            } else {
+                entry->second.used = false;
+                users[entry->second.mesh.get()]++;
+                entry++;
+            }
+        }
+        for(auto& entry : entries) entry.second.shared = users[entry.second.mesh.get()] > 1;
+    }
+
+    void clear() {
+        entries.clear();
+    }
+
+private:
+    struct Entry {
+        Key key;
+        bool used = false;
+        bool shared = false;
+        Mesh mesh;
+    };
+
+    Entry* lookup(const Key& key) {
+        auto entry = entries.find(key.id);
+        if(entry == entries.end() || entry->second.key.use_bvh != key.use_bvh) return nullptr;
+        return &entry->second;
+    }
+
+    std::unordered_map<Scene_ID, Entry> entries;
+};
+
+} // namespace PT
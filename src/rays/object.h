@@ -3,6 +3,7 @@
 
 #include "../lib/mathlib.h"
 #include "../scene/object.h"
+#include <memory>
 #include <variant>
 
 #include "bvh.h"
@@ -23,6 +24,11 @@ public:
         : trans(T), itrans(T.inverse()), _id(id), material(m), underlying(std::move(tri_mesh)) {
         has_trans = trans != Mat4::I;
     }
+    Object(std::shared_ptr<const Tri_Mesh> instance, Scene_ID id, unsigned int m = 0,
+           const Mat4& T = Mat4::I)
+        : trans(T), itrans(T.inverse()), _id(id), material(m), underlying(std::move(instance)) {
+        has_trans = trans != Mat4::I;
+    }
     Object(List<Object>&& list, Scene_ID id, unsigned int m = 0, const Mat4& T = Mat4::I)
         : trans(T), itrans(T.inverse()), _id(id), material(m), underlying(std::move(list)) {
         has_trans = trans != Mat4::I;
@@ -49,18 +55,90 @@ public:
     Object(Object&& src) = default;
 
     BBox bbox() const {
-        BBox box = std::visit([](const auto& o) { return o.bbox(); }, underlying);
+        BBox box = std::visit([](const auto& o) { return get(o).bbox(); }, underlying);
         if(has_trans) box.transform(trans);
         return box;
     }
 
-    Trace hit(Ray ray) const {
+    /// Closest hit along ray. Only the hit record is filled in; pass it to finalize to get
+    /// the position and normal.
+    Hit hit(Ray ray) const {
+        Vec3 dir = ray.dir;
         if(has_trans) ray.transform(itrans);
-        Trace ret = std::visit([&ray](const auto& o) { return o.hit(ray); }, underlying);
-        if(ret.hit) {
-            if(material != -1) ret.material = material;
-            if(has_trans) ret.transform(trans, itrans.T());
+        Hit ret = std::visit([&ray](const auto& o) { return get(o).hit(ray); }, underlying);
+        if(ret.hit) record(ret, dir);
+        return ret;
+    }
+
+    void hit(const Ray_Packet& packet, unsigned int mask, Hit* ret) const {
+
+        Hit local[Ray_Packet::size];
+        auto visit = [&](const Ray_Packet& p) {
+            std::visit([&](const auto& o) { get(o).hit(p, mask, local); }, underlying);
+        };
+
+        // Rays are only copied when they need to move into object space. Either way, the
+        // world-space bounds already exclude anything farther than ret, so every local
+        // hit is a new closest hit.
+        if(has_trans) {
+            Ray_Packet object_packet = packet;
+            object_packet.transform(itrans);
+            visit(object_packet);
+        } else {
+            visit(packet);
+        }
+
+        for(size_t i = 0; i < packet.count; i++) {
+            if(!local[i].hit) continue;
+            record(local[i], packet.rays[i].dir);
+            ret[i] = local[i];
+            packet.rays[i].dist_bounds.y = local[i].distance;
+        }
+    }
+
+    /// Whether anything lies along ray within its dist_bounds. Cheaper than hit, as the
+    /// search stops at the first intersection found (e.g. for shadow rays).
+    bool occluded(Ray ray) const {
+        if(has_trans) ray.transform(itrans);
+        return std::visit([&ray](const auto& o) { return get(o).occluded(ray); }, underlying);
+    }
+
+    /// Compute the world-space intersection for a hit returned by hit(ray)
+    Trace finalize(const Ray& ray, const Hit& hit) const {
+
+        if(!hit.hit) {
+            Trace ret;
+            ret.origin = ray.point;
+            return ret;
         }
+
+        // Every object between this one and the instance is untransformed, otherwise it
+        // would have recorded itself as the instance
+        if(hit.instance && hit.instance != this) return hit.instance->finalize(ray, hit);
+
+        Ray local = ray;
+        Hit local_hit = hit;
+        if(has_trans) {
+            local_hit.distance *= itrans.rotate(ray.dir).norm();
+            local.transform(itrans);
+        }
+
+        Trace ret = std::visit(
+            overloaded{[&](const Tri_Mesh& mesh) { return mesh.finalize(local, local_hit); },
+                       [&](const Instance& mesh) { return mesh->finalize(local, local_hit); },
+                       [&](const Shape& shape) { return shape.finalize(local); },
+                       [&](const auto& objects) {
+                           // Transformed aggregates don't remember which of their objects
+                           // was hit, so it is found again in their space
+                           Hit inner = objects.hit(local);
+                           if(!inner.hit) return Trace{};
+                           return inner.instance->finalize(local, inner);
+                       }},
+            underlying);
+
+        if(has_trans) ret.transform(trans, itrans.T());
+        ret.distance = hit.distance;
+        ret.material = hit.material;
         return ret;
     }
 
@@ -70,6 +148,9 @@ public:
             overloaded{
                 [&](const BVH<Object>& bvh) { return bvh.visualize(lines, active, level, vtrans); },
                 [&](const Tri_Mesh& mesh) { return mesh.visualize(lines, active, level, vtrans); },
+                [&](const Instance& mesh) {
+                    return mesh->visualize(lines, active, level, vtrans);
+                },
                 [](const auto&) { return size_t(0); }},
             underlying);
     }
@@ -79,6 +160,7 @@ public:
         Vec3 dir =
             std::visit(overloaded{[from](const List<Object>& list) { return list.sample(from); },
                                   [from](const Tri_Mesh& mesh) { return mesh.sample(from); },
+                                  [from](const Instance& mesh) { return mesh->sample(from); },
                                   [](const auto&) -> Vec3 {
                                       die("Sampling implicit objects/BVHs is not yet supported.");
                                   }},
@@ -95,6 +177,7 @@ public:
         return std::visit(
             overloaded{[ray, T, iT](const List<Object>& list) { return list.pdf(ray, T, iT); },
                        [ray, T, iT](const Tri_Mesh& mesh) { return mesh.pdf(ray, T, iT); },
+                       [ray, T, iT](const Instance& mesh) { return mesh->pdf(ray, T, iT); },
                        [](const auto&) -> float {
                            die("Sampling implicit objects/BVHs is not yet supported.");
                        }},
@@ -111,11 +194,36 @@ public:
     }
 
 private:
+    // Converts a hit from object space (this object's underlying primitive) to the space
+    // of its parent. dir is the ray direction in the parent's space.
+    void record(Hit& hit, const Vec3& dir) const {
+        if(material != -1) hit.material = material;
+        if(has_trans) {
+            // Object-space distances are scaled by the length of the transformed direction
+            hit.distance /= itrans.rotate(dir).norm();
+            hit.instance = this;
+        } else if(!std::holds_alternative<BVH<Object>>(underlying) &&
+                  !std::holds_alternative<List<Object>>(underlying)) {
+            hit.instance = this;
+        }
+    }
+
+    // Instanced meshes are shared by every object that references them, so the
+    // geometry and its BVH are stored once no matter how many copies are placed.
+    using Instance = std::shared_ptr<const Tri_Mesh>;
+
+    template<typename T> static const T& get(const T& o) {
+        return o;
+    }
+    static const Tri_Mesh& get(const Instance& o) {
+        return *o;
+    }
+
     bool has_trans = false;
     Mat4 trans, itrans;
     int material = -1;
     Scene_ID _id = 0;
-    std::variant<Tri_Mesh, Shape, BVH<Object>, List<Object>> underlying;
+    std::variant<Tri_Mesh, Instance, Shape, BVH<Object>, List<Object>> underlying;
 };
 
 } // namespace PT
@@ -0,0 +1,60 @@
+
+#pragma once
+
+#include "../lib/mathlib.h"
+#include "trace.h"
+
+namespace PT {
+
+// A small bundle of (ideally coherent) rays that are traced together: acceleration
+// structures fetch and test each node once for the whole packet, and triangles are
+// intersected against several rays at once.
+//
+// Packet queries have the form
+//      void hit(const Ray_Packet& packet, unsigned int mask, Hit* ret) const;
+// which intersects the rays whose lanes are set in mask. For every lane that hits
+// something closer than ret[lane], the query replaces ret[lane] and shrinks that ray's
+// dist_bounds.y to the new distance, so later tests can reject farther hits.
+struct Ray_Packet {
+
+    static constexpr size_t size = 8;
+
+    Ray_Packet() = default;
+
+    /// Add a ray to the next free lane and return the lane index
+    size_t add(const Ray& ray) {
+        assert(count < size);
+        size_t lane = count++;
+        rays[lane] = ray;
+        active |= 1u << lane;
+        update(lane);
+        return lane;
+    }
+
+    /// Move every ray into the space defined by this transform matrix
+    void transform(const Mat4& trans) {
+        for(size_t i = 0; i < count; i++) {
+            rays[i].transform(trans);
+            update(i);
+        }
+    }
+
+    /// Refresh the SoA copy of a lane after modifying its ray directly
+    void update(size_t lane) {
+        for(int a = 0; a < 3; a++) {
+            o[a][lane] = rays[lane].point.data[a];
+            d[a][lane] = rays[lane].dir.data[a];
+        }
+    }
+
+    Ray rays[size];
+    /// Number of lanes in use, and a bit mask of those lanes
+    size_t count = 0;
+    unsigned int active = 0;
+
+    /// Origins and directions in SoA layout, for vectorized primitive tests
+    alignas(16) float o[3][size] = {};
+    alignas(16) float d[3][size] = {};
+};
+
+} // namespace PT
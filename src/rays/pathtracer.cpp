@@ -1,19 +1,22 @@
 
 #include "pathtracer.h"
 #include "../geometry/util.h"
-#include "../gui/render.h"
 
-#include <SDL2/SDL.h>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
 #include <thread>
+#include <unordered_map>
 
 namespace PT {
 
-Pathtracer::Pathtracer(Gui::Widget_Render& gui, Vec2 screen_dim)
-    : thread_pool(std::thread::hardware_concurrency()), gui(gui), camera(screen_dim),
-      scene(List<Object>()) {
-    accumulator_samples = 0;
-    total_epochs = 0;
-    completed_epochs = 0;
+Pathtracer::Pathtracer(Vec2 screen_dim, Ray_Log ray_log)
+    : n_threads(std::max(1u, std::thread::hardware_concurrency())), thread_pool(n_threads),
+      ray_log(std::move(ray_log)), camera(screen_dim), scene(List<Object>()) {
+    queues = std::vector<Tile_Queue>(n_threads);
+    completed_batches = 0;
+    sample_budget = 0;
+    epoch = 0;
     out_w = out_h = 0;
     n_samples = 0;
 }
@@ -26,8 +29,11 @@ Pathtracer::~Pathtracer() {
 void Pathtracer::build_lights(Scene& layout_scene) {
 
     point_lights.clear();
+    directional_lights.clear();
     env_light.reset();
 
+    std::vector<Light_Bounds> bounds;
+
     layout_scene.for_items([&, this](const Scene_Item& item) {
         if(item.is<Scene_Light>()) {
 
@@ -36,12 +42,12 @@ void Pathtracer::build_lights(Scene& layout_scene) {
 
             switch(light.opt.type) {
             case Light_Type::directional: {
-                point_lights.push_back(
+                directional_lights.push_back(
                     Delta_Light(Directional_Light(r), light.id(), light.pose.transform()));
             } break;
             case Light_Type::sphere: {
                 if(light.opt.has_emissive_map) {
-                    env_light = Env_Light(Env_Map(light.emissive_copy()));
+                    env_light = Env_Light(Env_Map(light.emissive_copy(), &thread_pool));
                 } else {
                     env_light = Env_Light(Env_Sphere(r));
                 }
@@ -50,17 +56,53 @@ void Pathtracer::build_lights(Scene& layout_scene) {
                 env_light = Env_Light(Env_Hemisphere(r));
             } break;
             case Light_Type::point: {
-                point_lights.push_back(
-                    Delta_Light(Point_Light(r), light.id(), light.pose.transform()));
+                Mat4 T = light.pose.transform();
+                point_lights.push_back(Delta_Light(Point_Light(r), light.id(), T));
+                bounds.push_back(Light_Bounds::point(T * Vec3{}, 4.0f * PI_F * r.luma()));
             } break;
             case Light_Type::spot: {
-                point_lights.push_back(Delta_Light(Spot_Light(r, light.opt.angle_bounds),
-                                                   light.id(), light.pose.transform()));
+                Mat4 T = light.pose.transform();
+                Vec2 angles = light.opt.angle_bounds;
+                point_lights.push_back(Delta_Light(Spot_Light(r, angles), light.id(), T));
+                // Spot lights are brightest along +y and fade out between the two angles
+                float cos_start = std::cos(Radians(std::min(angles.x, 360.0f) / 2.0f));
+                float cos_end = std::cos(Radians(std::min(angles.y, 360.0f) / 2.0f));
+                float power = 2.0f * PI_F * r.luma() * (1.0f - 0.5f * (cos_start + cos_end));
+                Vec3 dir = T.rotate(Vec3{0.0f, 1.0f, 0.0f});
+                bounds.push_back(Light_Bounds::spot(T * Vec3{}, dir, cos_end, power));
             } break;
             default: return;
             }
         }
     });
+
+    point_light_bvh.build(std::move(bounds));
+}
+
+static size_t hash_geometry(const GL::Mesh& mesh) {
+    std::hash<float> hf;
+    std::hash<GL::Mesh::Index> hi;
+    size_t h = mesh.indices().size();
+    auto combine = [&h](size_t v) { h ^= v + 0x9e3779b9 + (h << 6) + (h >> 2); };
+    for(const GL::Mesh::Vert& v : mesh.verts()) {
+        for(int i = 0; i < 3; i++) {
+            combine(hf(v.pos[i]));
+            combine(hf(v.norm[i]));
+        }
+    }
+    for(GL::Mesh::Index i : mesh.indices()) combine(hi(i));
+    return h;
+}
+
+static bool same_geometry(const GL::Mesh& a, const GL::Mesh& b) {
+    if(&a == &b) return true;
+    if(a.verts().size() != b.verts().size() || a.indices() != b.indices()) return false;
+    for(size_t i = 0; i < a.verts().size(); i++) {
+        const GL::Mesh::Vert& va = a.verts()[i];
+        const GL::Mesh::Vert& vb = b.verts()[i];
+        if(va.pos != vb.pos || va.norm != vb.norm) return false;
+    }
+    return true;
 }
 
 void Pathtracer::build_scene(Scene& layout_scene) {
@@ -73,13 +115,100 @@ void Pathtracer::build_scene(Scene& layout_scene) {
     // of a deal, as BVH building should take at most a few seconds
     // even with many big meshes.
 
-    // We could also do instancing instead of duplicating the bvh
-    // for big meshes, but that's something to add in the future
+    // Mesh BVHs are built once per unique geometry and shared by reference: particles
+    // all instance their system's mesh, and objects with identical meshes (e.g. duplicated
+    // objects) share one BVH. The scene BVH is then built over the transformed instances,
+    // so memory and build time scale with unique geometry rather than instance count.
+    // Mesh BVHs are also cached across builds by geometry version, so when only poses,
+    // materials or lights changed, just the scene BVH is rebuilt. Meshes whose vertices
+    // moved without changing connectivity (skinning) have their BVHs refit instead.
 
     materials.clear();
 
-    std::vector<std::future<std::vector<Object>>> futures;
-    std::vector<Object> area_light_list;
+    using Mesh = Mesh_Cache::Mesh;
+    std::vector<Object> obj_list;
+    area_lights.clear();
+
+    std::mutex stats_mut;
+    size_t mesh_tris = 0, unique_meshes = 0, refit_meshes = 0;
+    float mesh_time = 0.0f;
+    auto add_stats = [&](const BVH_Stats& stats) {
+        std::lock_guard<std::mutex> lock(stats_mut);
+        mesh_tris += stats.primitives;
+        mesh_time += stats.build_time;
+        unique_meshes++;
+    };
+
+    bool use_bvh = scene_use_bvh;
+    auto build_instance = [&add_stats, use_bvh, this](const GL::Mesh& mesh) {
+        Mesh instance = std::make_shared<Tri_Mesh>(mesh, use_bvh, &thread_pool);
+        add_stats(instance->bvh_stats());
+        return instance;
+    };
+    auto refit_instance = [&, this](Mesh instance, const GL::Mesh& mesh) {
+        auto begin = std::chrono::steady_clock::now();
+        if(!instance->refit(mesh, &thread_pool)) return build_instance(mesh);
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+        float time = std::chrono::duration<float>(elapsed).count();
+        std::lock_guard<std::mutex> lock(stats_mut);
+        mesh_time += time;
+        refit_meshes++;
+        return instance;
+    };
+
+    struct Shared_Mesh {
+        const GL::Mesh* mesh;
+        std::shared_future<Mesh> instance;
+    };
+    struct Mesh_Request {
+        Mesh_Cache::Key key;
+        Mesh cached;
+        std::shared_future<Mesh> built;
+    };
+    struct Mesh_Object {
+        size_t request;
+        Scene_ID id;
+        unsigned int material;
+        Mat4 transform;
+        bool emissive = false;
+        Spectrum radiance;
+    };
+    struct Particle_System {
+        size_t request;
+        const Scene_Particles* particles;
+        unsigned int material;
+    };
+    std::unordered_map<size_t, std::vector<Shared_Mesh>> shared_meshes;
+    std::vector<Mesh_Request> requests;
+    std::vector<Mesh_Object> mesh_objects;
+    std::vector<Particle_System> particle_systems;
+
+    auto share_mesh = [&, this](const GL::Mesh& mesh) {
+        std::vector<Shared_Mesh>& bucket = shared_meshes[hash_geometry(mesh)];
+        for(const Shared_Mesh& shared : bucket) {
+            if(same_geometry(*shared.mesh, mesh)) return shared.instance;
+        }
+        std::shared_future<Mesh> instance =
+            thread_pool.enqueue([&mesh, &build_instance]() { return build_instance(mesh); });
+        bucket.push_back({&mesh, instance});
+        return instance;
+    };
+
+    // Only syncs and hashes the mesh if the cached BVH is out of date
+    auto request_mesh = [&, this](const Mesh_Cache::Key& key, auto&& get_mesh) {
+        Mesh_Request request = {key, mesh_cache.find(key), {}};
+        if(!request.cached) {
+            if(Mesh refit = mesh_cache.find_refit(key)) {
+                const GL::Mesh& mesh = get_mesh();
+                request.built = thread_pool.enqueue(
+                    [refit, &mesh, &refit_instance]() { return refit_instance(refit, mesh); });
+            } else {
+                request.built = share_mesh(get_mesh());
+            }
+        }
+        requests.push_back(std::move(request));
+        return requests.size() - 1;
+    };
 
     layout_scene.for_items([&, this](Scene_Item& item) {
         if(item.is<Scene_Object>()) {
@@ -106,30 +235,29 @@ void Pathtracer::build_scene(Scene& layout_scene) {
             case Material_Type::diffuse_light: {
                 materials.push_back(BSDF(BSDF_Diffuse(obj.material.emissive())));
                 // NOTE(max): we use an approximate triangle mesh for shape objects
-                // because PT::Object only supports sampling triangles
+                // because area lights only sample triangles. Emissive meshes are added
+                // below, once the instances they are traced with have been built.
                 if(obj.is_shape()) {
-                    area_light_list.push_back(Object(Tri_Mesh(obj.opt.shape.mesh(), false),
-                                                     obj.id(), idx, obj.pose.transform()));
-                } else {
-                    area_light_list.push_back(Object(Tri_Mesh(obj.posed_mesh(), false), obj.id(),
-                                                     idx, obj.pose.transform()));
+                    auto mesh = std::make_shared<Tri_Mesh>(obj.opt.shape.mesh(), use_bvh);
+                    mesh->prepare_sampling();
+                    area_lights.add(std::move(mesh), obj.pose.transform(),
+                                    obj.material.emissive());
                 }
             } break;
             default: return;
             }
 
-            bool use_bvh = scene_use_bvh;
-            futures.push_back(thread_pool.enqueue([&obj, use_bvh, idx]() {
-                std::vector<Object> objs;
-                if(obj.is_shape()) {
-                    Shape shape(obj.opt.shape);
-                    objs.emplace_back(std::move(shape), obj.id(), idx, obj.pose.transform());
-                } else {
-                    Tri_Mesh mesh(obj.posed_mesh(), use_bvh);
-                    objs.emplace_back(std::move(mesh), obj.id(), idx, obj.pose.transform());
-                }
-                return objs;
-            }));
+            if(obj.is_shape()) {
+                obj_list.emplace_back(Shape(obj.opt.shape), obj.id(), idx, obj.pose.transform());
+            } else {
+                auto mesh = [&obj]() -> const GL::Mesh& { return obj.posed_mesh(); };
+                Mesh_Cache::Key key = {obj.id(), obj.posed_mesh_version(),
+                                       obj.posed_topology_version(), use_bvh};
+                size_t request = request_mesh(key, mesh);
+                bool emissive = opt.type == Material_Type::diffuse_light;
+                mesh_objects.push_back({request, obj.id(), idx, obj.pose.transform(), emissive,
+                                        obj.material.emissive()});
+            }
 
         } else if(item.is<Scene_Particles>()) {
 
@@ -137,110 +265,430 @@ void Pathtracer::build_scene(Scene& layout_scene) {
             unsigned int idx = (unsigned int)materials.size();
             materials.push_back(BSDF(BSDF_Lambertian(particles.opt.color.to_linear())));
 
-            bool use_bvh = scene_use_bvh;
-            futures.push_back(thread_pool.enqueue([&particles, use_bvh, idx]() {
-                Tri_Mesh mesh(particles.mesh(), use_bvh);
-
-                const auto& parts = particles.get_particles();
-                std::vector<Object> particle_objs;
-
-                for(const Scene_Particles::Particle& p : parts) {
-                    Tri_Mesh copy = mesh.copy();
-                    Mat4 T = Mat4::translate(p.pos) * Mat4::scale(Vec3{particles.opt.scale});
-                    particle_objs.emplace_back(std::move(copy), particles.id(), idx, T);
-                }
-
-                return particle_objs;
-            }));
+            unsigned int version = particles.mesh_version();
+            Mesh_Cache::Key key = {particles.id(), version, version, use_bvh};
+            size_t request =
+                request_mesh(key, [&particles]() -> const GL::Mesh& { return particles.mesh(); });
+            particle_systems.push_back({request, &particles, idx});
         }
     });
 
-    std::vector<Object> obj_list;
+    std::vector<Mesh> meshes;
+    for(Mesh_Request& request : requests) {
+        Mesh mesh = request.cached ? request.cached : request.built.get();
+        mesh_cache.store(request.key, mesh);
+        meshes.push_back(std::move(mesh));
+    }
+    mesh_cache.prune();
+
+    // Lights sample the same instances the scene is traced with. Only their meshes build
+    // area tables, and cached meshes keep theirs until their geometry changes.
+    for(const Mesh_Object& obj : mesh_objects) {
+        const Mesh& mesh = meshes[obj.request];
+        if(obj.emissive) {
+            mesh->prepare_sampling();
+            area_lights.add(mesh, obj.transform, obj.radiance);
+        }
+        obj_list.emplace_back(mesh, obj.id, obj.material, obj.transform);
+    }
 
-    for(auto& f : futures) {
-        std::vector<Object> result = f.get();
-        obj_list.reserve(obj_list.size() + result.size());
-        std::move(std::begin(result), std::end(result), std::back_inserter(obj_list));
+    for(const Particle_System& system : particle_systems) {
+        const Scene_Particles& particles = *system.particles;
+        const auto& parts = particles.get_particles();
+        obj_list.reserve(obj_list.size() + parts.size());
+        for(const Scene_Particles::Particle& p : parts) {
+            Mat4 T = Mat4::translate(p.pos) * Mat4::scale(Vec3{particles.opt.scale});
+            obj_list.emplace_back(meshes[system.request], particles.id(), system.material, T);
+        }
     }
 
-    area_lights = List(std::move(area_light_list));
+    area_lights.build();
     build_lights(layout_scene);
 
     if(scene_use_bvh) {
-        BVH<Object> scene_bvh(std::move(obj_list));
+        BVH_Options opt;
+        opt.pool = &thread_pool;
+        BVH<Object> scene_bvh(std::move(obj_list), opt);
+
+        const BVH_Stats& stats = scene_bvh.stats();
+        info("Built %zu and refit %zu of %zu mesh BVHs (%zu triangles built) in %.3fs (summed)",
+             unique_meshes, refit_meshes, requests.size(), mesh_tris, mesh_time);
+        info("Built scene BVH over %zu objects in %.3fs: %zu nodes, SAH cost %.2f",
+             stats.primitives, stats.build_time, stats.nodes, stats.sah_cost);
+
         scene = Object(std::move(scene_bvh));
     } else {
         List<Object> scene_list(std::move(obj_list));
         scene = Object(std::move(scene_list));
     }
+    scene_built = true;
 }
 
 void Pathtracer::set_samples(size_t samples) {
     n_samples = samples;
 }
 
+void Pathtracer::set_seed(uint32_t seed) {
+    random_seed = seed;
+}
+
+void Pathtracer::set_sequence(RNG::Sequence seq) {
+    sequence = seq;
+}
+
+void Pathtracer::set_adaptive(float error, size_t max_samples) {
+    adaptive_error = error;
+    adaptive_max = max_samples;
+}
+
+void Pathtracer::set_threads(size_t threads) {
+    cancel();
+    n_threads = std::max(size_t(1), threads);
+    thread_pool.resize(n_threads);
+    queues = std::vector<Tile_Queue>(n_threads);
+    // Tile sizes depend on the number of workers
+    tiles.clear();
+}
+
 void Pathtracer::set_params(size_t w, size_t h, size_t samples, size_t depth, bool use_bvh) {
+    // Tiles cover the region, so they are rebuilt if it changes
+    if(w != out_w || h != out_h || region.x0 || region.y0 || region.x1 != w || region.y1 != h) {
+        tiles.clear();
+    }
     out_w = w;
     out_h = h;
     n_samples = samples;
     max_depth = depth;
     scene_use_bvh = use_bvh;
+    region = {0, 0, out_w, out_h};
     accumulator.resize(out_w, out_h);
 }
 
+void Pathtracer::set_region(HDR_Image::Rect r) {
+    region.x0 = std::min(r.x0, out_w);
+    region.y0 = std::min(r.y0, out_h);
+    region.x1 = std::clamp(r.x1, region.x0, out_w);
+    region.y1 = std::clamp(r.y1, region.y0, out_h);
+    tiles.clear();
+}
+
 void Pathtracer::log_ray(const Ray& ray, float t, Spectrum color) {
-    gui.log_ray(ray, t, color);
+    if(ray_log) ray_log(ray, t, color);
 }
 
-void Pathtracer::accumulate(const HDR_Image& sample) {
+void Pathtracer::build_tiles() {
 
-    std::lock_guard<std::mutex> lock(accumulator_mut);
+    // Shrink tiles for small outputs so every worker still has several tiles to steal
+    size_t w = region.x1 - region.x0, h = region.y1 - region.y0;
+    tile_size = 32;
+    while(tile_size > 8 &&
+          ((w + tile_size - 1) / tile_size) * ((h + tile_size - 1) / tile_size) < 4 * n_threads) {
+        tile_size /= 2;
+    }
 
-    accumulator_samples++;
-    for(size_t j = 0; j < out_h; j++) {
-        for(size_t i = 0; i < out_w; i++) {
-            Spectrum& s = accumulator.at(i, j);
-            const Spectrum& n = sample.at(i, j);
-            s += (n - s) * (1.0f / accumulator_samples);
+    tiles.clear();
+    for(size_t y = region.y0; y < region.y1; y += tile_size) {
+        for(size_t x = region.x0; x < region.x1; x += tile_size) {
+            Tile tile;
+            tile.x0 = x;
+            tile.y0 = y;
+            tile.x1 = std::min(x + tile_size, region.x1);
+            tile.y1 = std::min(y + tile_size, region.y1);
+            tiles.push_back(tile);
         }
     }
+
+    // Render from the center of the image outwards, which is usually where the
+    // interesting part of the frame is.
+    Vec2 center((float)out_w / 2.0f, (float)out_h / 2.0f);
+    auto dist = [center](const Tile& t) {
+        Vec2 c((float)(t.x0 + t.x1) / 2.0f, (float)(t.y0 + t.y1) / 2.0f);
+        return (c - center).norm_squared();
+    };
+    std::stable_sort(tiles.begin(), tiles.end(),
+                     [&dist](const Tile& l, const Tile& r) { return dist(l) < dist(r); });
+    tile_locks = std::vector<Tile_Lock>(tiles.size());
 }
 
-void Pathtracer::do_trace(size_t samples) {
+bool Pathtracer::next_tile(size_t worker, size_t& tile) {
 
-    HDR_Image sample(out_w, out_h);
-    for(size_t j = 0; j < out_h; j++) {
-        for(size_t i = 0; i < out_w; i++) {
+    {
+        Tile_Queue& own = queues[worker];
+        std::lock_guard<std::mutex> lock(own.mut);
+        if(!own.tiles.empty()) {
+            tile = own.tiles.front();
+            own.tiles.pop_front();
+            return true;
+        }
+    }
+
+    for(size_t i = 1; i < n_threads; i++) {
+        Tile_Queue& victim = queues[(worker + i) % n_threads];
+        std::lock_guard<std::mutex> lock(victim.mut);
+        if(!victim.tiles.empty()) {
+            tile = victim.tiles.back();
+            victim.tiles.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void Pathtracer::trace_packet(size_t x, size_t y, size_t n, const uint32_t* index, Spectrum* out,
+                              unsigned int mask) {
+
+    // Camera rays through neighbouring pixels are coherent, so the first bounce is
+    // traced as a packet; shading (and everything after it) proceeds ray by ray.
+    // Only the pixels set in mask are traced, taking sample index[i] of pixel x + i.
+    // Random numbers are seeded per sample, so lanes don't affect each other.
+    auto seed = [&](size_t i) {
+        RNG::seed(random_seed, (uint32_t)(y * out_w + x + i), index[i], sequence);
+    };
+
+    Ray_Packet packet;
+    Vec2 bounds[Ray_Packet::size];
+    size_t pixel[Ray_Packet::size];
+    for(size_t i = 0; i < n; i++) {
+        if(!(mask & (1u << i))) continue;
+        seed(i);
+        size_t lane = packet.add(pixel_ray(x + i, y));
+        bounds[lane] = packet.rays[lane].dist_bounds;
+        pixel[lane] = i;
+    }
 
-            size_t sampled = 0;
+    Hit hits[Ray_Packet::size];
+    scene.hit(packet, packet.active, hits);
+
+    for(size_t i = 0; i < packet.count; i++) {
+        // The packet query shrank the ray's bounds to the hit; shading starts from scratch
+        Ray& ray = packet.rays[i];
+        ray.dist_bounds = bounds[i];
+        seed(pixel[i]);
+        auto [emissive, reflected] = trace(ray, scene.finalize(ray, hits[i]));
+        out[pixel[i]] = emissive + reflected;
+    }
+}
+
+void Pathtracer::trace_tile(Tile& tile, Tile_Lock& tile_lock, size_t samples, uint64_t render) {
+
+    size_t tw = tile.x1 - tile.x0;
+    std::vector<Spectrum> sample(tw * (tile.y1 - tile.y0));
+
+    for(size_t j = tile.y0; j < tile.y1; j++) {
+        for(size_t i = tile.x0; i < tile.x1; i += Ray_Packet::size) {
+
+            size_t n = std::min(Ray_Packet::size, tile.x1 - i);
+            Spectrum* out = &sample[(j - tile.y0) * tw + (i - tile.x0)];
+
+            size_t sampled[Ray_Packet::size] = {};
             for(size_t s = 0; s < samples; s++) {
 
-                Spectrum p = trace_pixel(i, j);
-                if(p.valid()) {
-                    sample.at(i, j) += p;
-                    sampled++;
+                uint32_t index[Ray_Packet::size];
+                std::fill(index, index + n, (uint32_t)(tile.samples + s));
+
+                Spectrum p[Ray_Packet::size];
+                trace_packet(i, j, n, index, p);
+                for(size_t k = 0; k < n; k++) {
+                    if(p[k].valid()) {
+                        out[k] += p[k];
+                        sampled[k]++;
+                    }
                 }
 
-                if(cancel_flag) return;
+                if(cancelled(render)) return;
             }
 
-            if(sampled > 0) sample.at(i, j) *= (1.0f / sampled);
+            for(size_t k = 0; k < n; k++) {
+                if(sampled[k] > 0) out[k] *= (1.0f / sampled[k]);
+            }
+        }
+    }
+
+    // This worker owns the tile, so no other thread writes these pixels. The lock only
+    // keeps readers of the whole image from seeing a half-merged tile.
+    std::lock_guard<std::mutex> lock(tile_lock.mut);
+    float weight = (float)samples / (float)(tile.samples + samples);
+    for(size_t j = tile.y0; j < tile.y1; j++) {
+        Spectrum* row = accumulator.row(j);
+        for(size_t i = tile.x0; i < tile.x1; i++) {
+            Spectrum& s = row[i];
+            const Spectrum& n = sample[(j - tile.y0) * tw + (i - tile.x0)];
+            s += (n - s) * weight;
+        }
+    }
+    tile.samples += samples;
+    tile_lock.dirty = true;
+}
+
+bool Pathtracer::trace_tile_adaptive(Tile& tile, Tile_Lock& tile_lock, size_t samples,
+                                     uint64_t render) {
+
+    // Pixels are sampled in batches until their error estimate converges. Every pixel
+    // takes at least adaptive_min samples before its estimate is trusted, even if the
+    // budget has been spent by other tiles in the meantime.
+    auto wanted = [&](const Pixel_Stats& p) {
+        if(p.done) return size_t(0);
+        if(p.samples < adaptive_min) return std::min(samples, adaptive_min - p.samples);
+        if(sample_budget.load() <= 0) return size_t(0);
+        return std::min(samples, adaptive_max - p.samples);
+    };
+
+    bool active = false;
+
+    for(size_t j = tile.y0; j < tile.y1; j++) {
+        for(size_t i = tile.x0; i < tile.x1; i += Ray_Packet::size) {
+
+            size_t n = std::min(Ray_Packet::size, tile.x1 - i);
+            Pixel_Stats* stats = &pixel_stats[j * out_w + i];
+
+            size_t want[Ray_Packet::size] = {}, most = 0;
+            for(size_t k = 0; k < n; k++) {
+                want[k] = wanted(stats[k]);
+                most = std::max(most, want[k]);
+            }
+
+            Spectrum sum[Ray_Packet::size];
+            float luma[Ray_Packet::size] = {}, luma2[Ray_Packet::size] = {};
+            size_t valid[Ray_Packet::size] = {};
+            for(size_t s = 0; s < most; s++) {
+
+                unsigned int mask = 0;
+                uint32_t index[Ray_Packet::size];
+                for(size_t k = 0; k < n; k++) {
+                    if(s < want[k]) mask |= 1u << k;
+                    index[k] = stats[k].samples + (uint32_t)s;
+                }
+
+                Spectrum p[Ray_Packet::size];
+                trace_packet(i, j, n, index, p, mask);
+                for(size_t k = 0; k < n; k++) {
+                    if(!(mask & (1u << k)) || !p[k].valid()) continue;
+                    float l = p[k].luma();
+                    sum[k] += p[k];
+                    luma[k] += l;
+                    luma2[k] += l * l;
+                    valid[k]++;
+                }
+
+                if(cancelled(render)) return false;
+            }
+
+            // Merge the batch into the pixel's running mean and variance
+            std::lock_guard<std::mutex> lock(tile_lock.mut);
+            Spectrum* row = accumulator.row(j);
+            for(size_t k = 0; k < n; k++) {
+
+                Pixel_Stats& p = stats[k];
+                p.samples += (uint32_t)want[k];
+                sample_budget -= (long long)want[k];
+
+                if(valid[k] > 0) {
+                    float nb = (float)valid[k], na = (float)p.valid, nab = na + nb;
+                    float mean = luma[k] / nb;
+                    float m2 = std::max(luma2[k] - nb * mean * mean, 0.0f);
+                    float delta = mean - p.mean;
+                    p.mean += delta * nb / nab;
+                    p.m2 += m2 + delta * delta * na * nb / nab;
+                    p.valid += (uint32_t)valid[k];
+                    row[i + k] += (sum[k] * (1.0f / nb) - row[i + k]) * (nb / nab);
+                }
+
+                if(p.samples >= adaptive_max) {
+                    p.done = true;
+                } else if(p.samples >= adaptive_min && p.valid > 1) {
+                    // Relative standard error of the mean luminance. Dark pixels are
+                    // measured against a small floor, or noise around zero never converges
+                    float variance = p.m2 / (float)(p.valid - 1);
+                    float error = std::sqrt(variance / p.valid) / std::max(p.mean, 1e-3f);
+                    p.done = error < adaptive_error;
+                }
+                if(!p.done) active = true;
+            }
+            tile_lock.dirty = true;
+        }
+    }
+
+    // Pixels still below the minimum are sampled regardless of the budget
+    if(!active) return false;
+    if(sample_budget.load() > 0) return true;
+    for(size_t j = tile.y0; j < tile.y1; j++) {
+        for(size_t i = tile.x0; i < tile.x1; i++) {
+            if(wanted(pixel_stats[j * out_w + i])) return true;
+        }
+    }
+    return false;
+}
+
+void Pathtracer::do_trace(size_t worker, uint64_t render) {
+
+    size_t t;
+    while(!cancelled(render) && next_tile(worker, t)) {
+
+        Tile& tile = tiles[t];
+        bool requeue;
+        if(adaptive_error > 0.0f) {
+            requeue = trace_tile_adaptive(tile, tile_locks[t], batch_samples, render);
+        } else {
+            size_t samples = std::min(batch_samples, tile.target - tile.samples);
+            trace_tile(tile, tile_locks[t], samples, render);
+            requeue = tile.samples < tile.target;
+        }
+        if(cancelled(render)) return;
+
+        if(requeue) {
+            Tile_Queue& own = queues[worker];
+            std::lock_guard<std::mutex> lock(own.mut);
+            own.tiles.push_back(t);
+            if(adaptive_error > 0.0f) continue;
+        }
+
+        // The last batch records the render time in the same critical section that
+        // completes the render, so anyone who sees it finish can read the time
+        std::unique_lock<std::mutex> lock(done_mut);
+        if(++completed_batches == total_batches) {
+            render_time = std::chrono::steady_clock::now() - render_start;
+            lock.unlock();
+            done_cv.notify_all();
         }
     }
-    accumulate(sample);
 }
 
 bool Pathtracer::in_progress() const {
-    return completed_epochs.load() < total_epochs;
+    return completed_batches.load() < total_batches;
+}
+
+bool Pathtracer::wait(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(done_mut);
+    return done_cv.wait_for(lock, timeout, [this]() { return !in_progress(); });
 }
 
 std::pair<float, float> Pathtracer::completion_time() const {
-    double freq = (double)SDL_GetPerformanceFrequency();
-    return {(float)(build_time / freq), (float)(render_time / freq)};
+    using Seconds = std::chrono::duration<float>;
+    std::lock_guard<std::mutex> lock(done_mut);
+    return {Seconds(build_time).count(), Seconds(render_time).count()};
 }
 
 float Pathtracer::progress() const {
-    return (float)completed_epochs.load() / (float)total_epochs;
+    float done = (float)completed_batches.load() / (float)total_batches;
+    if(adaptive_error > 0.0f && total_budget > 0) {
+        float spent = 1.0f - (float)sample_budget.load() / (float)total_budget;
+        done = std::max(done, std::min(spent, 1.0f));
+    }
+    return done;
+}
+
+std::vector<size_t> Pathtracer::samples_per_pixel() const {
+    std::vector<size_t> ret(out_w * out_h);
+    if(adaptive_error > 0.0f && pixel_stats.size() == ret.size()) {
+        for(size_t i = 0; i < ret.size(); i++) ret[i] = pixel_stats[i].samples;
+        return ret;
+    }
+    for(const Tile& tile : tiles) {
+        for(size_t j = tile.y0; j < tile.y1; j++) {
+            for(size_t i = tile.x0; i < tile.x1; i++) ret[j * out_w + i] = tile.samples;
+        }
+    }
+    return ret;
 }
 
 size_t Pathtracer::visualize_bvh(GL::Lines& lines, GL::Lines& active, size_t depth) {
@@ -249,53 +697,334 @@ size_t Pathtracer::visualize_bvh(GL::Lines& lines, GL::Lines& active, size_t dep
 
 void Pathtracer::begin_render(Scene& layout_scene, const Camera& cam, bool add_samples) {
 
-    size_t n_threads = std::thread::hardware_concurrency();
-    size_t samples_per_epoch = std::max(size_t(1), n_samples / (n_threads * 10));
-
     cancel();
-    total_epochs = n_samples / samples_per_epoch + !!(n_samples % samples_per_epoch);
 
-    if(!add_samples) {
-        accumulator.clear({});
-        accumulator_samples = 0;
-        build_time = SDL_GetPerformanceCounter();
-        build_scene(layout_scene);
-        build_time = SDL_GetPerformanceCounter() - build_time;
+    if(!add_samples || tiles.empty()) {
+        // Distributed workers trace many small regions of a large image, so only
+        // the pixels about to be traced are reset
+        accumulator.clear({}, region);
+        display_stale = true;
+        pixel_stats.clear();
+        build_tiles();
+    }
+    if((!add_samples || !scene_built) && !scene_prebuilt) {
+        prebuild(layout_scene);
+        scene_prebuilt = false;
     }
-    render_time = SDL_GetPerformanceCounter();
+    start(cam);
+}
+
+void Pathtracer::restart(const Camera& cam) {
+
+    cancel();
+
+    if(tiles.empty()) build_tiles();
+    for(Tile& tile : tiles) tile.samples = tile.target = 0;
+    accumulator.clear({}, region);
+    display_stale = true;
+    pixel_stats.clear();
+    start(cam);
+}
+
+void Pathtracer::start(const Camera& cam) {
+
+    render_start = std::chrono::steady_clock::now();
 
     camera = cam;
 
-    for(size_t s = 0; s < n_samples; s += samples_per_epoch) {
-        size_t samples = (s + samples_per_epoch) > n_samples ? n_samples - s : samples_per_epoch;
-        thread_pool.enqueue([samples, this]() {
-            do_trace(samples);
-            size_t completed = completed_epochs++;
-            if(completed + 1 == total_epochs) {
-                Uint64 done = SDL_GetPerformanceCounter();
-                render_time = done - render_time;
-            }
-        });
+    // Tiles are traced in batches of samples and re-queued until they reach their
+    // target, so the whole image refines progressively.
+    batch_samples = std::max(size_t(1), n_samples / 16);
+    total_batches = 0;
+
+    if(adaptive_error > 0.0f) {
+        // The budget is shared by all pixels, so every tile is queued once and keeps
+        // re-queueing itself while it has pixels left to sample
+        if(pixel_stats.size() != out_w * out_h) total_budget = sample_budget = 0;
+        pixel_stats.resize(out_w * out_h);
+        for(Pixel_Stats& p : pixel_stats) p.done = false;
+
+        adaptive_max = std::max(adaptive_max, n_samples);
+        adaptive_min = std::min(std::max(size_t(2), n_samples / 4), adaptive_max);
+        long long budget = (long long)(n_samples * out_w * out_h);
+        total_budget += budget;
+        sample_budget += budget;
+
+        total_batches = tiles.size();
+        for(size_t i = 0; i < tiles.size(); i++) queues[i % n_threads].tiles.push_back(i);
+
+    } else {
+        for(size_t i = 0; i < tiles.size(); i++) {
+            Tile& tile = tiles[i];
+            tile.target += n_samples;
+            size_t remaining = tile.target - tile.samples;
+            if(remaining == 0) continue;
+            total_batches += remaining / batch_samples + !!(remaining % batch_samples);
+            queues[i % n_threads].tiles.push_back(i);
+        }
     }
+
+    uint64_t render = epoch.load();
+    for(size_t w = 0; w < n_threads; w++) {
+        workers.push_back(thread_pool.enqueue([w, render, this]() { do_trace(w, render); }));
+    }
+}
+
+void Pathtracer::prebuild(Scene& layout_scene) {
+    auto begin = std::chrono::steady_clock::now();
+    build_scene(layout_scene);
+    build_time = std::chrono::steady_clock::now() - begin;
+    scene_prebuilt = true;
 }
 
 void Pathtracer::cancel() {
-    cancel_flag = true;
+
+    // Workers of the old epoch return within a sample; the threads themselves stay up
+    epoch++;
     thread_pool.clear();
-    completed_epochs = 0;
-    total_epochs = 0;
-    cancel_flag = false;
-    if(completed_epochs < total_epochs) 
-        render_time = SDL_GetPerformanceCounter() - render_time;
+    for(std::future<void>& w : workers) w.wait();
+    workers.clear();
+
+    for(Tile_Queue& q : queues) q.tiles.clear();
+    completed_batches = 0;
+    {
+        std::lock_guard<std::mutex> lock(done_mut);
+        total_batches = 0;
+        done_cv.notify_all();
+    }
 }
 
 const HDR_Image& Pathtracer::get_output() {
     return accumulator;
 }
 
+static void copy_rect(const HDR_Image& src, HDR_Image& dst, HDR_Image::Rect rect) {
+    for(size_t j = rect.y0; j < rect.y1; j++) {
+        std::copy(src.row(j) + rect.x0, src.row(j) + rect.x1, dst.row(j) + rect.x0);
+    }
+}
+
+#ifndef SCOTTY3D_HEADLESS
 const GL::Tex2D& Pathtracer::get_output_texture(float exposure) {
-    std::lock_guard<std::mutex> lock(accumulator_mut);
-    return accumulator.get_texture(exposure);
+
+    // The display is a copy of the accumulator, so workers only wait while a tile they
+    // are merging is copied out, never for the tonemap. Only the updated tiles are copied
+    // and tonemapped, unless the whole image changed or the exposure did.
+    if(display_stale || display.dimension() != accumulator.dimension()) {
+        copy_output(display, [this](size_t t) { tile_locks[t].dirty = false; });
+        display_stale = false;
+    } else {
+        for(size_t t = 0; t < tiles.size(); t++) {
+            const Tile& tile = tiles[t];
+            HDR_Image::Rect rect = {tile.x0, tile.y0, tile.x1, tile.y1};
+            {
+                std::lock_guard<std::mutex> lock(tile_locks[t].mut);
+                if(!tile_locks[t].dirty) continue;
+                copy_rect(accumulator, display, rect);
+                tile_locks[t].dirty = false;
+            }
+            display.mark_dirty(rect);
+        }
+    }
+
+    // While rendering, the workers are busy, so the pool would only delay the tonemap
+    return display.get_texture(exposure, in_progress() ? nullptr : &thread_pool);
+}
+#endif
+
+void Pathtracer::tonemap_to(std::vector<unsigned char>& data, float exposure) {
+    snapshot().tonemap_to(data, exposure, in_progress() ? nullptr : &thread_pool);
+}
+
+HDR_Image Pathtracer::snapshot() {
+    HDR_Image ret;
+    copy_output(ret);
+    return ret;
+}
+
+void Pathtracer::copy_output(HDR_Image& image, const std::function<void(size_t)>& f) {
+
+    if(image.dimension() != std::pair{out_w, out_h}) image.resize(out_w, out_h);
+
+    // Only the tiles are written while rendering; they cover the region
+    HDR_Image::Rect traced = tiles.empty() ? HDR_Image::Rect{0, 0, 0, 0} : region;
+    copy_rect(accumulator, image, {0, 0, out_w, traced.y0});
+    copy_rect(accumulator, image, {0, traced.y1, out_w, out_h});
+    copy_rect(accumulator, image, {0, traced.y0, traced.x0, traced.y1});
+    copy_rect(accumulator, image, {traced.x1, traced.y0, out_w, traced.y1});
+
+    for(size_t t = 0; t < tiles.size(); t++) {
+        const Tile& tile = tiles[t];
+        std::lock_guard<std::mutex> lock(tile_locks[t].mut);
+        copy_rect(accumulator, image, {tile.x0, tile.y0, tile.x1, tile.y1});
+        if(f) f(t);
+    }
+    image.mark_dirty();
+}
+
+// Checkpoints are raw native-endian dumps: they resume renders on the machine (or kind
+// of machine) that wrote them, and are not meant as an interchange format.
+static const char checkpoint_magic[8] = {'S', '3', 'D', 'C', 'K', 'P', 'T', '1'};
+
+template<typename T> static void write_raw(std::ofstream& out, const T& value) {
+    out.write((const char*)&value, sizeof(T));
+}
+
+template<typename T> static void read_raw(std::ifstream& in, T& value) {
+    in.read((char*)&value, sizeof(T));
+}
+
+std::string Pathtracer::save_checkpoint(std::string file) {
+
+    // Each tile is copied together with its samples and stats, one tile at a time, so
+    // workers keep merging into the others meanwhile
+    HDR_Image pixels;
+    std::vector<Tile> saved_tiles(tiles.size());
+    std::vector<Pixel_Stats> saved_stats(adaptive_error > 0.0f ? pixel_stats.size() : 0);
+    copy_output(pixels, [&](size_t t) {
+        const Tile& tile = saved_tiles[t] = tiles[t];
+        if(saved_stats.empty()) return;
+        for(size_t j = tile.y0; j < tile.y1; j++) {
+            auto row = pixel_stats.begin() + j * out_w;
+            std::copy(row + tile.x0, row + tile.x1, saved_stats.begin() + j * out_w + tile.x0);
+        }
+    });
+
+    // Every sample taken comes out of the budget, so the budget left is what the copied
+    // stats have not spent. Reading the counter instead could disagree with them.
+    long long saved_total = total_budget, saved_remaining = total_budget;
+    for(const Pixel_Stats& p : saved_stats) saved_remaining -= p.samples;
+
+    // Write next to the old checkpoint and swap it in, so being killed mid-write never
+    // loses the last good one
+    std::string temp = file + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary);
+        if(!out) return "Failed to open " + temp + " for writing.";
+
+        out.write(checkpoint_magic, sizeof(checkpoint_magic));
+        write_raw(out, (uint64_t)out_w);
+        write_raw(out, (uint64_t)out_h);
+        write_raw(out, (uint32_t)random_seed);
+        write_raw(out, (uint32_t)sequence);
+        write_raw(out, (uint8_t)(adaptive_error > 0.0f));
+
+        write_raw(out, (uint64_t)saved_tiles.size());
+        for(const Tile& t : saved_tiles) {
+            for(size_t v : {t.x0, t.y0, t.x1, t.y1, t.samples, t.target}) {
+                write_raw(out, (uint64_t)v);
+            }
+        }
+
+        write_raw(out, (int64_t)saved_total);
+        write_raw(out, (int64_t)saved_remaining);
+        write_raw(out, (uint64_t)saved_stats.size());
+        for(const Pixel_Stats& p : saved_stats) {
+            write_raw(out, p.samples);
+            write_raw(out, p.valid);
+            write_raw(out, p.mean);
+            write_raw(out, p.m2);
+        }
+
+        for(size_t j = 0; j < out_h; j++) {
+            out.write((const char*)pixels.row(j), out_w * sizeof(Spectrum));
+        }
+        if(!out) return "Failed to write " + temp + ".";
+    }
+
+#ifdef _WIN32
+    std::remove(file.c_str());
+#endif
+    if(std::rename(temp.c_str(), file.c_str())) return "Failed to replace " + file + ".";
+    return {};
+}
+
+std::string Pathtracer::load_checkpoint(std::string file) {
+
+    std::ifstream in(file, std::ios::binary);
+    if(!in) return "Failed to open " + file + ".";
+
+    char magic[sizeof(checkpoint_magic)] = {};
+    in.read(magic, sizeof(magic));
+    if(!in || !std::equal(magic, magic + sizeof(magic), checkpoint_magic)) {
+        return file + " is not a checkpoint.";
+    }
+
+    uint64_t w = 0, h = 0;
+    uint32_t seed = 0, seq = 0;
+    uint8_t adaptive = 0;
+    read_raw(in, w);
+    read_raw(in, h);
+    read_raw(in, seed);
+    read_raw(in, seq);
+    read_raw(in, adaptive);
+    if(!in) return "Failed to read " + file + ".";
+    if(w != out_w || h != out_h) {
+        return "Checkpoint is " + std::to_string(w) + "x" + std::to_string(h) +
+               ", but the output is " + std::to_string(out_w) + "x" + std::to_string(out_h) +
+               ".";
+    }
+    if(!!adaptive != (adaptive_error > 0.0f)) {
+        return adaptive ? "Checkpoint was sampled adaptively, but this render is not."
+                        : "Checkpoint was sampled uniformly, but this render is adaptive.";
+    }
+
+    uint64_t n_tiles = 0;
+    read_raw(in, n_tiles);
+    if(!in || n_tiles == 0 || n_tiles > w * h) return "Failed to read " + file + ".";
+    std::vector<Tile> loaded_tiles(n_tiles);
+    for(Tile& t : loaded_tiles) {
+        uint64_t v[6] = {};
+        for(uint64_t& x : v) read_raw(in, x);
+        t.x0 = v[0], t.y0 = v[1], t.x1 = v[2], t.y1 = v[3], t.samples = v[4], t.target = v[5];
+        if(t.x0 >= t.x1 || t.x1 > w || t.y0 >= t.y1 || t.y1 > h) {
+            return "Checkpoint has an invalid tile.";
+        }
+    }
+
+    int64_t saved_total = 0, saved_remaining = 0;
+    uint64_t n_stats = 0;
+    read_raw(in, saved_total);
+    read_raw(in, saved_remaining);
+    read_raw(in, n_stats);
+    if(!in || n_stats != (adaptive ? w * h : 0)) return "Failed to read " + file + ".";
+    std::vector<Pixel_Stats> loaded_stats(n_stats);
+    for(Pixel_Stats& p : loaded_stats) {
+        read_raw(in, p.samples);
+        read_raw(in, p.valid);
+        read_raw(in, p.mean);
+        read_raw(in, p.m2);
+    }
+
+    std::vector<Spectrum> pixels(w * h);
+    in.read((char*)pixels.data(), pixels.size() * sizeof(Spectrum));
+    if(!in) return "Failed to read " + file + ".";
+
+    cancel();
+
+    random_seed = seed;
+    sequence = (RNG::Sequence)seq;
+    for(size_t j = 0; j < out_h; j++) {
+        std::copy(pixels.begin() + j * out_w, pixels.begin() + (j + 1) * out_w,
+                  accumulator.row(j));
+    }
+    display_stale = true;
+
+    // begin_render(..., true) adds n_samples to every target (and to the sample budget),
+    // so take them off here: the render continues to the larger of the two counts
+    tiles = std::move(loaded_tiles);
+    tile_locks = std::vector<Tile_Lock>(tiles.size());
+    for(Tile& t : tiles) {
+        t.target = std::max(t.target, t.samples);
+        t.target = t.target > n_samples ? t.target - n_samples : 0;
+    }
+
+    pixel_stats = std::move(loaded_stats);
+    long long budget = (long long)(n_samples * out_w * out_h);
+    long long spent = saved_total - saved_remaining;
+    total_budget = std::max((long long)saved_total, budget) - budget;
+    sample_budget = total_budget - spent;
+    return {};
 }
 
 Vec3 Pathtracer::sample_area_lights(Vec3 from) {
@@ -328,20 +1057,29 @@ Spectrum Pathtracer::point_lighting(const Shading_Info& hit) {
 
     if(hit.bsdf.is_discrete()) return {};
 
-    Spectrum radiance;
-    for(auto& light : point_lights) {
+    auto shade = [&](const Delta_Light& light) -> Spectrum {
         Light_Sample sample = light.sample(hit.pos);
         Vec3 in_dir = hit.world_to_object.rotate(sample.direction);
 
         Spectrum attenuation = hit.bsdf.evaluate(hit.out_dir, in_dir);
-        if(attenuation.luma() == 0.0f) continue;
+        if(attenuation.luma() == 0.0f) return {};
 
         Ray shadow_ray(hit.pos, sample.direction, Vec2{EPS_F, sample.distance - EPS_F});
 
-        Trace shadow = scene.hit(shadow_ray);
-        if(!shadow.hit) {
-            radiance += attenuation * sample.radiance;
-        }
+        if(scene.occluded(shadow_ray)) return {};
+        return attenuation * sample.radiance;
+    };
+
+    Spectrum radiance;
+    for(auto& light : directional_lights) radiance += shade(light);
+
+    if(point_lights.size() <= max_shaded_lights) {
+        for(auto& light : point_lights) radiance += shade(light);
+    } else {
+        // One light per vertex, chosen by its estimated contribution
+        float pmf;
+        size_t light = point_light_bvh.sample(hit.pos, RNG::unit(), pmf);
+        if(pmf > 0.0f) radiance += shade(point_lights[light]) * (1.0f / pmf);
     }
 
     return radiance;
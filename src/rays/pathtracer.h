@@ -2,42 +2,88 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <mutex>
 #include <unordered_map>
 
 #include "../lib/mathlib.h"
 #include "../scene/scene.h"
 #include "../util/hdr_image.h"
+#include "../util/rand.h"
 #include "../util/thread_pool.h"
 
 #include "bsdf.h"
 #include "env_light.h"
 #include "light.h"
+#include "light_bvh.h"
+#include "mesh_cache.h"
 #include "object.h"
 
-namespace Gui {
-class Widget_Render;
-}
-
 namespace PT {
 
 class Pathtracer {
 public:
-    Pathtracer(Gui::Widget_Render& gui, Vec2 screen_dim);
+    /// Receives the rays passed to log_ray, e.g. to visualize them
+    using Ray_Log = std::function<void(const Ray& ray, float t, Spectrum color)>;
+
+    Pathtracer(Vec2 screen_dim, Ray_Log ray_log = {});
     ~Pathtracer();
 
     void set_params(size_t w, size_t h, size_t pixel_samples, size_t depth, bool use_bvh);
     void set_samples(size_t samples);
+    /// Seed for the random numbers of every sample. Renders with the same seed and sample
+    /// counts are identical, regardless of the number of threads.
+    void set_seed(uint32_t seed);
+    /// Sequence that 2D sample decisions (pixel, BSDF and light samples) are drawn from
+    void set_sequence(RNG::Sequence sequence);
+    /// Sample adaptively: pixels stop once the relative error of their mean falls below
+    /// error, and the samples they would have taken go to noisier pixels, up to
+    /// max_samples each. The total budget is still pixel_samples per pixel on average.
+    /// An error of zero samples every pixel uniformly.
+    void set_adaptive(float error, size_t max_samples);
+    /// Number of worker threads, by default one per hardware thread. Cancels any render.
+    void set_threads(size_t threads);
+    /// Only trace the pixels within region; set_params resets it to the whole image.
+    /// Pixels are sampled exactly as in a render of the whole image.
+    void set_region(HDR_Image::Rect region);
 
     const HDR_Image& get_output();
+#ifndef SCOTTY3D_HEADLESS
     const GL::Tex2D& get_output_texture(float exposure);
+#endif
+    /// Tonemap the output to RGBA8, using the worker threads if no render is running
+    void tonemap_to(std::vector<unsigned char>& data, float exposure);
+    /// A consistent copy of the output, which may be taken while rendering
+    HDR_Image snapshot();
     size_t visualize_bvh(GL::Lines& lines, GL::Lines& active, size_t level);
 
     void begin_render(Scene& scene, const Camera& camera, bool add_samples = false);
+    /// Start over from a new camera, tracing the scene of the last render without building
+    /// it again. Suited to interactive camera edits.
+    void restart(const Camera& camera);
+    /// Build the scene ahead of time. Until the next prebuild, begin_render traces this
+    /// build instead of building its own, which lets another Pathtracer trace the previous
+    /// frame meanwhile, or several renders of one frame share a build.
+    void prebuild(Scene& scene);
+
+    /// Save the output and the samples behind it, so the render can be continued later.
+    /// May be called while rendering; the checkpoint holds every sample merged so far.
+    std::string save_checkpoint(std::string file);
+    /// Restore a checkpoint saved with the same image size and sampling mode. Calling
+    /// begin_render(scene, camera, true) afterwards continues the render until every pixel
+    /// has the larger of the checkpoint's and the current sample count.
+    std::string load_checkpoint(std::string file);
     void cancel();
     bool in_progress() const;
+    /// Wait until the render completes or the timeout passes; returns whether it completed
+    bool wait(std::chrono::milliseconds timeout);
     float progress() const;
     std::pair<float, float> completion_time() const;
+    /// Number of samples traced through each pixel, in row-major order
+    std::vector<size_t> samples_per_pixel() const;
 
 private:
     struct Shading_Info {
@@ -47,27 +93,98 @@ private:
         size_t depth = 0;
     };
 
+    // A rectangular region [x0,x1) x [y0,y1) of the output image. Each tile is owned by
+    // at most one worker at a time, so workers can write into the accumulator directly.
+    struct Tile {
+        size_t x0, y0, x1, y1;
+        size_t samples = 0, target = 0;
+    };
+
+    // Guards a tile's pixels in the accumulator, its sample count and its pixel stats.
+    // Workers only hold the lock of the tile they are merging, so they never wait on each
+    // other; checkpoints, snapshots and the display take the tiles' locks one at a time.
+    struct Tile_Lock {
+        std::mutex mut;
+        /// Merged into since the output texture was last updated
+        bool dirty = false;
+    };
+
+    // Running statistics of a pixel's luminance, used to estimate its error when sampling
+    // adaptively. samples counts every sample traced; valid only those that were finite.
+    struct Pixel_Stats {
+        uint32_t samples = 0, valid = 0;
+        float mean = 0.0f, m2 = 0.0f;
+        bool done = false;
+    };
+
+    // Per-worker tile deque: the owner pops from the front, thieves steal from the back.
+    struct Tile_Queue {
+        std::mutex mut;
+        std::deque<size_t> tiles;
+    };
+
     void build_scene(Scene& scene);
     void build_lights(Scene& scene);
-    void do_trace(size_t samples);
-    void accumulate(const HDR_Image& sample);
-    bool tonemap();
-
-    Gui::Widget_Render& gui;
-    unsigned long long render_time, build_time;
+    void build_tiles();
+    bool next_tile(size_t worker, size_t& tile);
+    // Each render is an epoch. Workers trace on behalf of one and stop as soon as they
+    // notice it has ended, without waiting for the current tile to finish.
+    bool cancelled(uint64_t render) const {
+        return epoch.load(std::memory_order_relaxed) != render;
+    }
+    void start(const Camera& camera);
+    void do_trace(size_t worker, uint64_t render);
+    void trace_tile(Tile& tile, Tile_Lock& tile_lock, size_t samples, uint64_t render);
+    bool trace_tile_adaptive(Tile& tile, Tile_Lock& tile_lock, size_t samples,
+                             uint64_t render);
+    /// Copy the accumulator into image, taking the tiles' locks one at a time. f(t) is
+    /// called under the lock of tile t, to copy whatever else the tile guards.
+    void copy_output(HDR_Image& image, const std::function<void(size_t)>& f = {});
+    void trace_packet(size_t x, size_t y, size_t n, const uint32_t* index, Spectrum* out,
+                      unsigned int mask = ~0u);
+
+    Ray_Log ray_log;
+    std::chrono::steady_clock::time_point render_start;
+    std::chrono::steady_clock::duration render_time{}, build_time{};
+    size_t n_threads;
     Thread_Pool thread_pool;
-    bool cancel_flag = false;
+    std::atomic<uint64_t> epoch;
+    std::vector<std::future<void>> workers;
 
+    // Workers merge samples into the pixels of the tile they own under its Tile_Lock.
+    // The rest of the image is only written between renders.
     HDR_Image accumulator;
-    std::mutex accumulator_mut;
-    size_t total_epochs, accumulator_samples;
-    std::atomic<size_t> completed_epochs;
-
+    // What get_output_texture last copied out of the accumulator to tonemap. Stale when
+    // the accumulator changed outside the tiles' dirty flags, e.g. when it was cleared.
+    HDR_Image display;
+    bool display_stale = true;
+
+    std::vector<Tile> tiles;
+    std::vector<Tile_Lock> tile_locks;
+    std::vector<Tile_Queue> queues;
+    size_t tile_size = 0, batch_samples = 1, total_batches = 0;
+    HDR_Image::Rect region = {};
+    std::atomic<size_t> completed_batches;
+    // Signaled when the last batch completes or the render is cancelled. Batches complete
+    // under done_mut, and the last one sets render_time before releasing it.
+    mutable std::mutex done_mut;
+    std::condition_variable done_cv;
+
+    // When sampling adaptively, tiles are re-queued until all of their pixels are done or
+    // the image's sample budget runs out, so each tile counts as a single batch.
+    float adaptive_error = 0.0f;
+    size_t adaptive_min = 0, adaptive_max = 0;
+    long long total_budget = 0;
+    std::atomic<long long> sample_budget;
+    std::vector<Pixel_Stats> pixel_stats;
+
+    Ray pixel_ray(size_t x, size_t y);
     Spectrum trace_pixel(size_t x, size_t y);
     Spectrum sample_direct_lighting(const Shading_Info& hit);
     Spectrum sample_indirect_lighting(const Shading_Info& hit);
 
     std::pair<Spectrum, Spectrum> trace(const Ray& ray);
+    std::pair<Spectrum, Spectrum> trace(const Ray& ray, Trace result);
     Spectrum point_lighting(const Shading_Info& hit);
     Vec3 sample_area_lights(Vec3 from);
     float area_lights_pdf(Vec3 from, Vec3 dir);
@@ -75,15 +192,22 @@ private:
     void log_ray(const Ray& ray, float t, Spectrum color = Spectrum{1.0f});
 
     Object scene;
-    List<Object> area_lights;
-    bool scene_use_bvh = true;
+    Mesh_Cache mesh_cache;
+    Area_Lights area_lights;
+    bool scene_use_bvh = true, scene_built = false, scene_prebuilt = false;
 
     std::vector<BSDF> materials;
-    std::vector<Delta_Light> point_lights;
+    // Point and spot lights are importance sampled through a light BVH once there are
+    // more than max_shaded_lights of them; until then each one is shaded at every vertex.
+    static constexpr size_t max_shaded_lights = 8;
+    std::vector<Delta_Light> point_lights, directional_lights;
+    Light_BVH point_light_bvh;
     std::optional<Env_Light> env_light;
 
     Camera camera;
     size_t out_w, out_h, n_samples, max_depth;
+    uint32_t random_seed = 0;
+    RNG::Sequence sequence = RNG::Sequence::sobol;
 };
 
 } // namespace PT
@@ -5,6 +5,7 @@
 #include "../lib/mathlib.h"
 #include "../platform/gl.h"
 
+#include "packet.h"
 #include "trace.h"
 #include <variant>
 
@@ -44,7 +45,33 @@ public:
         return std::visit(overloaded{[](const auto& o) { return o.bbox(); }}, underlying);
     }
 
-    Trace hit(Ray ray) const {
+    Hit hit(const Ray& ray) const {
+        Trace trace = finalize(ray);
+        Hit ret;
+        ret.hit = trace.hit;
+        ret.distance = trace.distance;
+        return ret;
+    }
+
+    // Implicit shapes are cheap to test, so packets are just traced ray by ray
+    void hit(const Ray_Packet& packet, unsigned int mask, Hit* ret) const {
+        for(size_t i = 0; i < packet.count; i++) {
+            if(!(mask & (1u << i))) continue;
+            Hit test = hit(packet.rays[i]);
+            if(test.hit) {
+                ret[i] = test;
+                packet.rays[i].dist_bounds.y = test.distance;
+            }
+        }
+    }
+
+    bool occluded(const Ray& ray) const {
+        return hit(ray).hit;
+    }
+
+    /// Full intersection record of the closest hit along ray. Shapes don't remember where
+    /// they were hit, but are cheap enough to simply intersect again.
+    Trace finalize(const Ray& ray) const {
         return std::visit(overloaded{[&ray](const auto& o) { return o.hit(ray); }}, underlying);
     }
 
@@ -5,6 +5,34 @@
 
 namespace PT {
 
+class Object;
+
+// What traversal records about a ray intersection: just enough to compare candidates and
+// to reconstruct the surface point afterwards. Position and normal are only computed for
+// the closest hit, by Object::finalize (or Tri_Mesh::finalize).
+struct Hit {
+
+    bool hit = false;
+    float distance = 0.0f;
+    int material = 0;
+
+    /// Triangle index within its mesh and barycentric coordinates of the hit point
+    unsigned int primitive = 0;
+    Vec2 bary;
+    /// Object whose surface was hit (set by Object::hit)
+    const Object* instance = nullptr;
+
+    static Hit min(const Hit& l, const Hit& r) {
+        if(l.hit && r.hit) {
+            if(l.distance < r.distance) return l;
+            return r;
+        }
+        if(l.hit) return l;
+        if(r.hit) return r;
+        return {};
+    }
+};
+
 struct Trace {
 
     bool hit = false;
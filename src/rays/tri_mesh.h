@@ -4,10 +4,13 @@
 #include "../lib/mathlib.h"
 #include "../platform/gl.h"
 
+#include "alias_table.h"
 #include "bvh.h"
 #include "list.h"
 #include "trace.h"
 
+#include <memory>
+
 namespace PT {
 
 struct Tri_Mesh_Vert {
@@ -15,10 +18,38 @@ struct Tri_Mesh_Vert {
     Vec3 normal;
 };
 
+// Vertex and triangle data shared by a mesh's triangles. Intersection tests only read the
+// precomputed first vertex and edge vectors of each triangle, which are stored SoA and (for
+// BVH meshes) in BVH leaf order, so the triangles of a leaf are adjacent in memory. Vertex
+// normals are only fetched once the closest hit is known.
+struct Tri_Mesh_Data {
+    std::vector<Tri_Mesh_Vert> verts;
+    /// Three vertex indices per triangle
+    std::vector<unsigned int> indices;
+    /// First vertex and edges p1 - p0, p2 - p0 of each triangle, one array per component
+    std::vector<float> p0[3], e1[3], e2[3];
+    /// Chooses triangles in proportion to their area, so that sampled points are uniform
+    /// over the surface. Only built for meshes sampled as lights (Tri_Mesh::prepare_sampling)
+    /// and discarded by precompute, as the triangles it refers to may have changed.
+    Samplers::Alias_Table areas;
+    /// Total area of the triangles in areas
+    float area = 0.0f;
+
+    size_t triangles() const {
+        return indices.size() / 3;
+    }
+    /// Recompute the intersection data of every triangle from verts and indices
+    void precompute();
+};
+
 class Triangle {
 public:
     BBox bbox() const;
-    Trace hit(const Ray& ray) const;
+    Hit hit(const Ray& ray) const;
+    void hit(const Ray_Packet& packet, unsigned int mask, Hit* ret) const;
+    bool occluded(const Ray& ray) const {
+        return hit(ray).hit;
+    }
 
     size_t visualize(GL::Lines&, GL::Lines&, size_t, const Mat4&) const {
         return size_t(0);
@@ -28,17 +59,21 @@ public:
     float pdf(Ray ray, const Mat4& T, const Mat4& iT) const;
 
 private:
-    Triangle(Tri_Mesh_Vert* verts, unsigned int v0, unsigned int v1, unsigned int v2);
+    Triangle(const Tri_Mesh_Data* mesh, unsigned int idx);
+
+    const Tri_Mesh_Vert& vert(unsigned int i) const;
+    /// Interpolated shading normal at barycentric coordinates (u, v)
+    Vec3 normal(Vec2 bary) const;
 
-    unsigned int v0, v1, v2;
-    Tri_Mesh_Vert* vertex_list;
+    const Tri_Mesh_Data* mesh;
+    unsigned int idx;
     friend class Tri_Mesh;
 };
 
 class Tri_Mesh {
 public:
     Tri_Mesh() = default;
-    Tri_Mesh(const GL::Mesh& mesh, bool use_bvh = true);
+    Tri_Mesh(const GL::Mesh& mesh, bool use_bvh = true, Thread_Pool* pool = nullptr);
 
     Tri_Mesh(Tri_Mesh&& src) = default;
     Tri_Mesh& operator=(Tri_Mesh&& src) = default;
@@ -48,18 +83,41 @@ public:
     Tri_Mesh copy() const;
 
     BBox bbox() const;
-    Trace hit(const Ray& ray) const;
+    Hit hit(const Ray& ray) const;
+    void hit(const Ray_Packet& packet, unsigned int mask, Hit* ret) const;
+    /// Whether any triangle lies along ray within its dist_bounds
+    bool occluded(const Ray& ray) const;
+    /// Position and interpolated shading normal of a hit found by hit(ray)
+    Trace finalize(const Ray& ray, const Hit& hit) const;
 
     size_t visualize(GL::Lines& lines, GL::Lines& active, size_t level, const Mat4& trans) const;
 
-    void build(const GL::Mesh& mesh, bool use_bvh = true);
+    void build(const GL::Mesh& mesh, bool use_bvh = true, Thread_Pool* pool = nullptr);
+    /// Move the vertices to those of mesh, which must have the same connectivity as the
+    /// mesh this was built from, and refit the BVH. Returns false if the vertex counts differ.
+    bool refit(const GL::Mesh& mesh, Thread_Pool* pool = nullptr);
+    const BVH_Stats& bvh_stats() const;
+
+    /// Build the area table sample() and pdf() choose triangles with. Only meshes that are
+    /// sampled as lights need it; building or refitting the mesh discards it again.
+    void prepare_sampling();
+    /// Surface area, once prepared for sampling
+    float area() const;
 
+    /// Direction from a point towards a uniformly sampled point on the surface
     Vec3 sample(Vec3 from) const;
+    /// Solid angle density of sample() producing ray, which is in world space; T and iT
+    /// map the mesh to world space and back. Only the triangles along ray are tested.
     float pdf(Ray ray, const Mat4& T, const Mat4& iT) const;
 
 private:
+    // Permutes the triangle data into BVH leaf order
+    void reorder();
+    List<Triangle> make_list() const;
+
     bool use_bvh = true;
-    std::vector<Tri_Mesh_Vert> verts;
+    // Heap allocated so the triangles' pointers to it survive moves
+    std::unique_ptr<Tri_Mesh_Data> data;
     BVH<Triangle> triangle_bvh;
     List<Triangle> triangle_list;
 };
@@ -0,0 +1,86 @@
+
+// scotty3d_render: path-traces a scene file to an image without SDL, OpenGL or the GUI,
+// so it can run on machines with no display or graphics drivers. Takes the single-frame
+// options of Scotty3D --headless; animations are still rendered by Scotty3D itself.
+
+#include "headless.h"
+#include "lib/log.h"
+#include "rays/pathtracer.h"
+#include "scene/scene.h"
+#include "util/camera.h"
+#include "util/rand.h"
+
+#include "gui/widget_ids.h"
+
+#include <sf_libs/CLI11.hpp>
+
+// Matches Gui::Render::load_cam, which sets up the GUI's render camera
+static Camera load_cam(const Scene::Load_Info::Cam& info, float wh_ar) {
+
+    float ar = info.ar == 0.0f ? wh_ar : info.ar;
+
+    float fov = 2.0f * std::atan((1.0f / ar) * std::tan(info.hfov / 2.0f));
+    fov = Degrees(fov);
+
+    Camera c(Vec2{ar, 1.0f});
+    c.look_at(info.center, info.pos);
+    c.set_ar(ar);
+    c.set_fov(fov);
+    c.set_ap(info.ap);
+    c.set_dist(info.dist);
+    return c;
+}
+
+int main(int argc, char** argv) {
+
+    RNG::seed();
+
+    Launch_Settings set;
+    set.headless = true;
+    CLI::App args{"Scotty3D - 15-462 (headless renderer)"};
+    Headless::add_options(args, set);
+
+    CLI11_PARSE(args, argc, argv);
+
+    if(set.scene_file.empty()) {
+        warn("No scene file given; pass one with --scene.");
+        return 1;
+    }
+
+    Scene scene(Gui::n_Widget_IDs);
+    Scene::Load_Info load_info;
+
+    info("Loading scene file...");
+    Scene::Load_Opts opts;
+    opts.new_scene = true;
+    std::string err = scene.load(opts, set.scene_file, load_info);
+    if(!err.empty()) {
+        warn("Error loading scene: %s", err.c_str());
+        return 1;
+    }
+
+    if(!set.env_map_file.empty()) {
+        info("Loading environment map...");
+        err = scene.set_env_map(set.env_map_file);
+        if(!err.empty()) warn("Error loading environment map: %s", err.c_str());
+    }
+
+    Camera cam(Vec2{(float)set.w, (float)set.h});
+    if(load_info.render_cam) cam = load_cam(*load_info.render_cam, (float)set.w / set.h);
+    if(set.w_from_ar) set.w = (int)std::ceil(cam.get_ar() * set.h);
+
+    PT::Pathtracer tracer(Vec2{(float)set.w, (float)set.h});
+    Headless::print_settings(set);
+    Headless::configure(tracer, set);
+
+    info("Rendering scene...");
+    err = Headless::render_frame(tracer, scene, cam, set);
+    if(!err.empty()) {
+        warn("Error rendering scene: %s", err.c_str());
+        return 1;
+    }
+
+    auto [build, render] = tracer.completion_time();
+    info("Built scene in %.2fs, rendered in %.2fs", build, render);
+    return 0;
+}
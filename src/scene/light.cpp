@@ -2,7 +2,10 @@
 #include "light.h"
 
 #include "../geometry/util.h"
+
+#ifndef SCOTTY3D_HEADLESS
 #include "renderer.h"
+#endif
 
 #include <sstream>
 
@@ -57,9 +60,11 @@ std::string Scene_Light::emissive_loaded() const {
     return _emissive.loaded_from();
 }
 
+#ifndef SCOTTY3D_HEADLESS
 const GL::Tex2D& Scene_Light::emissive_texture() const {
     return _emissive.get_texture();
 }
+#endif
 
 BBox Scene_Light::bbox() const {
     BBox box = _mesh.bbox();
@@ -99,6 +104,7 @@ Spectrum Scene_Light::radiance() const {
     return opt.spectrum * opt.intensity;
 }
 
+#ifndef SCOTTY3D_HEADLESS
 void Scene_Light::render(const Mat4& view, bool depth_only, bool posed) {
 
     if(_dirty) regen_mesh();
@@ -129,6 +135,7 @@ void Scene_Light::render(const Mat4& view, bool depth_only, bool posed) {
         renderer.mesh(_mesh, opts);
     }
 }
+#endif
 
 bool operator!=(const Scene_Light::Options& l, const Scene_Light::Options& r) {
     return l.type != r.type || std::string(l.name) != std::string(r.name) ||
@@ -27,7 +27,9 @@ public:
     Scene_ID id() const;
     BBox bbox() const;
 
+#ifndef SCOTTY3D_HEADLESS
     void render(const Mat4& view, bool depth_only = false, bool posed = true);
+#endif
     void dirty();
 
     Spectrum radiance() const;
@@ -37,7 +39,9 @@ public:
     std::string emissive_loaded() const;
     HDR_Image emissive_copy() const;
 
+#ifndef SCOTTY3D_HEADLESS
     const GL::Tex2D& emissive_texture() const;
+#endif
     void emissive_clear();
     bool is_env() const;
 
@@ -1,9 +1,13 @@
 
 #include "object.h"
-#include "renderer.h"
 
 #include "../geometry/util.h"
-#include "../gui/render.h"
+
+#ifndef SCOTTY3D_HEADLESS
+#include "renderer.h"
+#endif
+
+#include <atomic>
 
 Scene_Object::Scene_Object(Scene_ID id, Pose p, GL::Mesh&& m, std::string n)
     : pose(p), _id(id), armature(id), _mesh(std::move(m)) {
@@ -32,12 +36,27 @@ Scene_Object::Scene_Object(Scene_ID id, Pose p, Halfedge_Mesh&& m, std::string n
     sync_anim_mesh();
 }
 
+unsigned int next_geometry_version() {
+    static std::atomic<unsigned int> next = 0;
+    return next++;
+}
+
 const GL::Mesh& Scene_Object::posed_mesh() {
     sync_anim_mesh();
     if(armature.has_bones()) return _anim_mesh;
     return _mesh;
 }
 
+unsigned int Scene_Object::posed_mesh_version() {
+    sync_anim_mesh();
+    return version;
+}
+
+unsigned int Scene_Object::posed_topology_version() {
+    sync_anim_mesh();
+    return topology_version;
+}
+
 Scene_ID Scene_Object::id() const {
     return _id;
 }
@@ -50,6 +69,7 @@ const GL::Mesh& Scene_Object::mesh() {
 void Scene_Object::try_make_editable(PT::Shape_Type prev) {
 
     _mesh = opt.shape.mesh();
+    version = topology_version = next_geometry_version();
 
     std::string err = halfedge.from_mesh(_mesh);
     if(err.empty()) {
@@ -105,6 +125,7 @@ const Halfedge_Mesh& Scene_Object::get_mesh() const {
 
 void Scene_Object::sync_anim_mesh() {
     sync_mesh();
+    if(skel_dirty || pose_dirty) version = next_geometry_version();
     if(skel_dirty && armature.has_bones()) {
         vertex_joints.clear();
         armature.find_joints(_mesh, vertex_joints);
@@ -137,6 +158,7 @@ void Scene_Object::sync_mesh() {
 
     if(editable && mesh_dirty) {
         halfedge.to_mesh(_mesh, !opt.smooth_normals);
+        version = topology_version = next_geometry_version();
         mesh_dirty = false;
     } else if(mesh_dirty && is_shape()) {
         mesh_dirty = false;
@@ -176,6 +198,7 @@ BBox Scene_Object::bbox() {
     return box;
 }
 
+#ifndef SCOTTY3D_HEADLESS
 void Scene_Object::render(const Mat4& view, bool solid, bool depth_only, bool posed, bool do_anim) {
 
     if(!opt.render) return;
@@ -212,6 +235,7 @@ void Scene_Object::render(const Mat4& view, bool solid, bool depth_only, bool po
     case PT::Shape_Type::count: break;
     }
 }
+#endif
 
 bool operator!=(const Scene_Object::Options& l, const Scene_Object::Options& r) {
     return std::string(l.name) != std::string(r.name) || l.shape_type != r.shape_type ||
@@ -12,6 +12,10 @@
 using Scene_ID = unsigned int;
 constexpr int MAX_NAME_LEN = 256;
 
+/// Returns a new, globally unique geometry version. Items bump their version whenever the
+/// mesh they render changes, so caches can tell whether data built from it is stale.
+unsigned int next_geometry_version();
+
 namespace PT {
 template<typename T> class BVH;
 class Object;
@@ -36,9 +40,13 @@ public:
 
     const GL::Mesh& mesh();
     const GL::Mesh& posed_mesh();
+    unsigned int posed_mesh_version();
+    unsigned int posed_topology_version();
 
+#ifndef SCOTTY3D_HEADLESS
     void render(const Mat4& view, bool solid = false, bool depth_only = false, bool posed = true,
                 bool anim = true);
+#endif
 
     Halfedge_Mesh& get_mesh();
     const Halfedge_Mesh& get_mesh() const;
@@ -86,6 +94,9 @@ private:
     mutable bool editable = true;
     mutable bool mesh_dirty = false;
     mutable bool skel_dirty = false, pose_dirty = false;
+    mutable unsigned int version = next_geometry_version();
+    // Only bumped when the mesh is regenerated, not when it is re-skinned
+    mutable unsigned int topology_version = version;
 };
 
 bool operator!=(const Scene_Object::Options& l, const Scene_Object::Options& r);
@@ -4,7 +4,10 @@
 #include "../util/rand.h"
 
 #include "particles.h"
+
+#ifndef SCOTTY3D_HEADLESS
 #include "renderer.h"
+#endif
 
 Scene_Particles::Scene_Particles(Scene_ID id)
     : arrow(Util::arrow_mesh(0.03f, 0.075f, 1.0f)), particle_instances(Util::sphere_mesh(1.0f, 1)) {
@@ -44,12 +47,18 @@ BBox Scene_Particles::bbox() const {
 
 void Scene_Particles::take_mesh(GL::Mesh&& mesh) {
     particle_instances = GL::Instances(std::move(mesh));
+    version = next_geometry_version();
+}
+
+unsigned int Scene_Particles::mesh_version() const {
+    return version;
 }
 
 const GL::Mesh& Scene_Particles::mesh() const {
     return particle_instances.mesh();
 }
 
+#ifndef SCOTTY3D_HEADLESS
 void Scene_Particles::render(const Mat4& view, bool depth_only, bool posed, bool particles_only) {
 
     Renderer& renderer = Renderer::get();
@@ -74,6 +83,7 @@ void Scene_Particles::render(const Mat4& view, bool depth_only, bool posed, bool
         renderer.instances(opts, particle_instances);
     }
 }
+#endif
 
 Scene_ID Scene_Particles::id() const {
     return _id;
@@ -84,6 +94,12 @@ void Scene_Particles::clear() {
     particle_instances.clear();
 }
 
+void Scene_Particles::reset() {
+    clear();
+    last_update = 0.0f;
+    particle_cooldown = 0.0f;
+}
+
 void Scene_Particles::set_time(float time) {
     if(panim.splines.any()) {
         panim.at(time, opt);
@@ -38,6 +38,9 @@ public:
     Scene_Particles& operator=(Scene_Particles&& src) = default;
 
     void clear();
+    /// Remove every particle and restart the step and emission timers, returning to the
+    /// state before the first step
+    void reset();
     void step(const PT::Object& scene, float dt);
     void step2(const PT::Object& scene, float dt);
     void gen_instances();
@@ -45,12 +48,15 @@ public:
     const std::vector<Particle>& get_particles() const;
 
     BBox bbox() const;
+#ifndef SCOTTY3D_HEADLESS
     void render(const Mat4& view, bool depth_only = false, bool posed = true,
                 bool particles_only = false);
+#endif
     Scene_ID id() const;
     void set_time(float time);
 
     const GL::Mesh& mesh() const;
+    unsigned int mesh_version() const;
     void take_mesh(GL::Mesh&& mesh);
 
     struct Options {
@@ -86,6 +92,7 @@ private:
     float radius = 0.0f;
     float last_update = 0.0f;
     double particle_cooldown = 0.0f;
+    unsigned int version = next_geometry_version();
 };
 
 bool operator!=(const Scene_Particles::Options& l, const Scene_Particles::Options& r);
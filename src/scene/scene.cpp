@@ -5,13 +5,15 @@
 #include <assimp/scene.h>
 #include <sstream>
 
-#include "../gui/manager.h"
-#include "../gui/render.h"
 #include "../lib/log.h"
+#include "scene.h"
 
+#ifndef SCOTTY3D_HEADLESS
+#include "../gui/manager.h"
+#include "../gui/render.h"
 #include "renderer.h"
-#include "scene.h"
 #include "undo.h"
+#endif
 
 namespace std {
 template<typename T1, typename T2> struct hash<pair<T1, T2>> {
@@ -36,6 +38,7 @@ BBox Scene_Item::bbox() {
     return std::visit([](auto& obj) { return obj.bbox(); }, data);
 }
 
+#ifndef SCOTTY3D_HEADLESS
 void Scene_Item::render(const Mat4& view, bool solid, bool depth_only, bool posed) {
     std::visit(
         overloaded{[&](Scene_Object& obj) { obj.render(view, solid, depth_only, posed); },
@@ -43,6 +46,7 @@ void Scene_Item::render(const Mat4& view, bool solid, bool depth_only, bool pose
                    [&](Scene_Particles& particles) { particles.render(view, depth_only, posed); }},
         data);
 }
+#endif
 
 Scene_ID Scene_Item::id() const {
     return std::visit([](auto& obj) { return obj.id(); }, data);
@@ -186,11 +190,10 @@ Scene_Maybe Scene::get(Scene_ID id) {
     return entry->second;
 }
 
-void Scene::clear(Undo& undo) {
+void Scene::clear() {
     next_id = first_id;
     objs.clear();
     erased.clear();
-    undo.reset();
 }
 
 //////////////////////////////////////////////////////////////
@@ -622,13 +625,9 @@ static unsigned int load_flags(Scene::Load_Opts opt) {
     return flags;
 }
 
-std::string Scene::load(Scene::Load_Opts loader, Undo& undo, Gui::Manager& gui, std::string file) {
+std::string Scene::load(Scene::Load_Opts loader, std::string file, Load_Info& info) {
 
-    if(loader.new_scene) {
-        clear(undo);
-        gui.get_animate().clear();
-        gui.get_rig().clear();
-    }
+    if(loader.new_scene) clear();
 
     Assimp::Importer importer;
     const aiScene* scene = importer.ReadFile(file.c_str(), load_flags(loader));
@@ -656,13 +655,13 @@ std::string Scene::load(Scene::Load_Opts loader, Undo& undo, Gui::Manager& gui,
             Vec3 pos = cam_transform * aiVec(aiCam.mPosition);
             Vec3 center = cam_transform * aiVec(aiCam.mLookAt);
 
+            Load_Info::Cam cam{pos, center, aiCam.mAspect, aiCam.mHorizontalFOV,
+                               aiCam.mClipPlaneNear, aiCam.mClipPlaneFar};
             std::string name(aiCam.mName.C_Str());
             if(name.find(ANIM_CAM_NAME) != std::string::npos) {
-                gui.get_animate().load_cam(pos, center, aiCam.mAspect, aiCam.mHorizontalFOV,
-                                           aiCam.mClipPlaneNear, aiCam.mClipPlaneFar);
+                info.anim_cam = cam;
             } else {
-                gui.get_render().load_cam(pos, center, aiCam.mAspect, aiCam.mHorizontalFOV,
-                                          aiCam.mClipPlaneNear, aiCam.mClipPlaneFar);
+                info.render_cam = cam;
             }
         };
 
@@ -804,9 +803,6 @@ std::string Scene::load(Scene::Load_Opts loader, Undo& undo, Gui::Manager& gui,
         return entry->second;
     };
 
-    Gui::Anim_Camera& cam = gui.get_animate().camera();
-    float ar = gui.get_render().get_cam().get_ar();
-
     // Load animation data
     for(unsigned int i = 0; i < scene->mNumAnimations; i++) {
 
@@ -817,8 +813,8 @@ std::string Scene::load(Scene::Load_Opts loader, Undo& undo, Gui::Manager& gui,
             loaded = false;
 
             // Load animated camera
-            load_anim(node, ANIM_CAM_NODE, [&cam, ar](float t, Vec3 p, Quat q, Vec3 s) {
-                cam.splines.set(t, p, q, s.x, ar, s.y - 1.0f, s.z);
+            load_anim(node, ANIM_CAM_NODE, [&info](float t, Vec3 p, Quat q, Vec3 s) {
+                info.anim_cam_keys.push_back({t, p, q, s.x, s.y - 1.0f, s.z});
             });
 
             // Load animated bones
@@ -889,11 +885,10 @@ std::string Scene::load(Scene::Load_Opts loader, Undo& undo, Gui::Manager& gui,
         }
 
         if(anim->mDuration > 0.0f) {
-            gui.get_animate().set((int)std::ceil(anim->mDuration),
-                                  (int)std::round(anim->mTicksPerSecond), loader.new_scene);
+            info.animations.push_back(
+                {(int)std::ceil(anim->mDuration), (int)std::round(anim->mTicksPerSecond)});
         }
     }
-    gui.get_animate().refresh(*this);
 
     std::stringstream stream;
     if(errors.size()) {
@@ -906,6 +901,39 @@ std::string Scene::load(Scene::Load_Opts loader, Undo& undo, Gui::Manager& gui,
     return stream.str();
 }
 
+#ifndef SCOTTY3D_HEADLESS
+std::string Scene::load(Scene::Load_Opts loader, Undo& undo, Gui::Manager& gui, std::string file) {
+
+    if(loader.new_scene) {
+        undo.reset();
+        gui.get_animate().clear();
+        gui.get_rig().clear();
+    }
+
+    Load_Info info;
+    std::string err = load(loader, file, info);
+
+    if(info.render_cam) {
+        const Load_Info::Cam& c = *info.render_cam;
+        gui.get_render().load_cam(c.pos, c.center, c.ar, c.hfov, c.ap, c.dist);
+    }
+    if(info.anim_cam) {
+        const Load_Info::Cam& c = *info.anim_cam;
+        gui.get_animate().load_cam(c.pos, c.center, c.ar, c.hfov, c.ap, c.dist);
+    }
+
+    Gui::Anim_Camera& cam = gui.get_animate().camera();
+    float ar = gui.get_render().get_cam().get_ar();
+    for(const Load_Info::Cam_Key& k : info.anim_cam_keys) {
+        cam.splines.set(k.t, k.pos, k.rot, k.fov, ar, k.ap, k.dist);
+    }
+    for(auto [frames, fps] : info.animations) {
+        gui.get_animate().set(frames, fps, loader.new_scene);
+    }
+    gui.get_animate().refresh(*this);
+    return err;
+}
+
 static void write_particles(aiLight* ai_light, const Scene_Particles::Options& opt,
                             std::string name) {
 
@@ -1636,3 +1664,4 @@ std::string Scene::write(std::string file, const Camera& render_cam,
     }
     return {};
 }
+#endif
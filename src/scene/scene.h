@@ -36,7 +36,9 @@ public:
     Scene_Item& operator=(const Scene_Item& src) = delete;
 
     BBox bbox();
+#ifndef SCOTTY3D_HEADLESS
     void render(const Mat4& view, bool solid = false, bool depth_only = false, bool posed = true);
+#endif
     Scene_ID id() const;
 
     Pose& pose();
@@ -81,9 +83,33 @@ public:
         bool debone = false;
     };
 
+    // What a scene file specifies besides its items
+    struct Load_Info {
+        // Scotty3D stores the aperture and focal distance in the clipping planes
+        struct Cam {
+            Vec3 pos, center;
+            float ar = 0.0f, hfov = 0.0f, ap = 0.0f, dist = 0.0f;
+        };
+        struct Cam_Key {
+            float t;
+            Vec3 pos;
+            Quat rot;
+            float fov, ap, dist;
+        };
+        std::optional<Cam> render_cam, anim_cam;
+        std::vector<Cam_Key> anim_cam_keys;
+        // Length in frames and frame rate of each animation
+        std::vector<std::pair<int, int>> animations;
+    };
+
+    /// Load the items of a scene file, and report what else it specifies in info. Doesn't
+    /// need the GUI, so headless builds load scenes through this.
+    std::string load(Load_Opts opt, std::string file, Load_Info& info);
+#ifndef SCOTTY3D_HEADLESS
     std::string write(std::string file, const Camera& cam, const Gui::Animate& animation);
     std::string load(Load_Opts opt, Undo& undo, Gui::Manager& gui, std::string file);
-    void clear(Undo& undo);
+#endif
+    void clear();
 
     bool empty();
     size_t size();
@@ -130,7 +156,9 @@ private:
         unsigned int objs = 0;
         unsigned int nodes = 0;
     };
+#ifndef SCOTTY3D_HEADLESS
     Stats get_stats(const Gui::Animate& animation);
+#endif
 
     std::map<Scene_ID, Scene_Item> objs;
     std::map<Scene_ID, Scene_Item> erased;
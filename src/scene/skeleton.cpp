@@ -1,7 +1,11 @@
 
 #include "skeleton.h"
+#include "../gui/widget_ids.h"
+
+#ifndef SCOTTY3D_HEADLESS
 #include "../gui/manager.h"
 #include "renderer.h"
+#endif
 
 Joint::Joint(unsigned int id) : _id(id) {
 }
@@ -102,6 +106,7 @@ Joint* Skeleton::get_joint(unsigned int id) {
     return j;
 }
 
+#ifndef SCOTTY3D_HEADLESS
 void Skeleton::render(const Mat4& view, Joint* jselect, IK_Handle* hselect, bool root, bool posed,
                       unsigned int offset) {
 
@@ -184,6 +189,7 @@ void Skeleton::outline(const Mat4& view, const Mat4& model, bool root, bool pose
         R.capsule(opt, M, j->extent.norm(), j->radius, box);
     });
 }
+#endif
 
 bool Skeleton::is_root_id(unsigned int id) {
     return id == root_id;
@@ -4,10 +4,21 @@
 
 bool BBox::hit(const Ray& ray, Vec2& times) const {
 
-    // TODO (PathTracer):
-    // Implement ray - bounding box intersection test
-    // If the ray intersected the bounding box within the range given by
-    // [times.x,times.y], update times with the new intersection times.
+    // Slab test: intersect the ray's [times.x,times.y] interval with the interval
+    // in which it lies between each pair of axis-aligned planes. Comparisons are
+    // written so that NaNs (a ray parallel to and inside a slab) never shrink it.
 
-    return false;
+    float tmin = times.x, tmax = times.y;
+    for(int a = 0; a < 3; a++) {
+        float inv = 1.0f / ray.dir[a];
+        float t0 = (min[a] - ray.point[a]) * inv;
+        float t1 = (max[a] - ray.point[a]) * inv;
+        if(inv < 0.0f) std::swap(t0, t1);
+        tmin = t0 > tmin ? t0 : tmin;
+        tmax = t1 < tmax ? t1 : tmax;
+        if(tmax < tmin) return false;
+    }
+
+    times = Vec2(tmin, tmax);
+    return true;
 }
@@ -1,12 +1,23 @@
 
 #include "../rays/bvh.h"
+#include "../util/thread_pool.h"
 #include "debug.h"
+
+#include <chrono>
 #include <stack>
+#include <tuple>
 
 namespace PT {
 
 template<typename Primitive>
 void BVH<Primitive>::build(std::vector<Primitive>&& prims, size_t max_leaf_size) {
+    BVH_Options opt;
+    opt.max_leaf_size = max_leaf_size;
+    build(std::move(prims), opt);
+}
+
+template<typename Primitive>
+void BVH<Primitive>::build(std::vector<Primitive>&& prims, const BVH_Options& opt) {
 
     // NOTE (PathTracer):
     // This BVH is parameterized on the type of the primitive it contains. This allows
@@ -14,97 +25,893 @@ void BVH<Primitive>::build(std::vector<Primitive>&& prims, size_t max_leaf_size)
     // we use this to both build a BVH over triangles within each Tri_Mesh, and over
     // a variety of Objects (which might be Tri_Meshes, Spheres, etc.) in Pathtracer.
     //
-    // The Primitive interface must implement these two functions:
+    // The Primitive interface must implement these functions:
     //      BBox bbox() const;
-    //      Trace hit(const Ray& ray) const;
-    // Hence, you may call bbox() and hit() on any value of type Primitive.
+    //      Hit hit(const Ray& ray) const;
+    //      bool occluded(const Ray& ray) const;
+    // Hence, you may call bbox(), hit() and occluded() on any value of type Primitive.
     //
     // Finally, also note that while a BVH is a tree structure, our BVH nodes don't
     // contain pointers to children, but rather indicies. This is because instead
     // of allocating each node individually, the BVH class contains a vector that
     // holds all of the nodes. Hence, to get the child of a node, you have to
-    // look up the child index in this vector (e.g. nodes[node.l]). Similarly,
-    // to create a new node, don't allocate one yourself - use BVH::new_node, which
-    // returns the index of a newly added node.
+    // look up the child index in this vector (e.g. nodes[idx + 1] or nodes[node.offset]).
+
+    auto begin = std::chrono::steady_clock::now();
 
-    // Keep these
     nodes.clear();
-    primitives = std::move(prims);
+    root_idx = 0;
+    build_stats = {};
+    options = opt;
+    options.pool = nullptr;
+    built_cost = 0.0f;
+#if SCOTTY3D_BVH_WIDTH > 2
+    wide_nodes.clear();
+#endif
+
+    if(prims.empty()) {
+        primitives.clear();
+        return;
+    }
+    assert(prims.size() < UINT32_MAX);
+
+    // The builder only ever shuffles these references; the primitives themselves
+    // are moved into leaf order once at the end.
+    std::vector<Build_Ref> refs(prims.size());
+    for(size_t i = 0; i < prims.size(); i++) {
+        refs[i].box = prims[i].bbox();
+        refs[i].center = refs[i].box.center();
+        refs[i].idx = i;
+    }
+
+    root_idx = build_range(nodes, refs, 0, refs.size(), opt, 0);
+
+    primitives.clear();
+    primitives.reserve(prims.size());
+    for(const Build_Ref& ref : refs) {
+        primitives.push_back(std::move(prims[ref.idx]));
+    }
+    prims.clear();
+
+    compute_stats(opt);
+#if SCOTTY3D_BVH_WIDTH > 2
+    collapse();
+#endif
+    built_cost = sah_cost();
+    build_stats.build_time =
+        std::chrono::duration<float>(std::chrono::steady_clock::now() - begin).count();
+}
+
+template<typename Primitive>
+size_t BVH<Primitive>::build_range(std::vector<Node>& out, std::vector<Build_Ref>& refs,
+                                   size_t start, size_t end, const BVH_Options& opt,
+                                   size_t depth) {
+
+    // Binned SAH construction: primitives are bucketed by centroid along each axis, and
+    // we pick the bucket boundary minimizing
+    //      C_trav + C_isect * (SA(L) * N(L) + SA(R) * N(R)) / SA(parent)
+
+    BBox box, cbox;
+    for(size_t i = start; i < end; i++) {
+        box.enclose(refs[i].box);
+        cbox.enclose(refs[i].center);
+    }
+
+    size_t n = end - start;
+    size_t idx = out.size();
+    Node leaf;
+    leaf.bbox = box;
+    leaf.offset = (uint32_t)start;
+    leaf.size = (uint32_t)n;
+    out.push_back(leaf);
+
+    if(n == 1) return idx;
+
+    size_t n_bins = std::max(opt.bins, size_t(2));
+    float area = box.surface_area();
+    float inv_area = area > 0.0f ? 1.0f / area : 0.0f;
+
+    int best_axis = -1;
+    size_t best_split = 0;
+    float best_cost = FLT_MAX;
+
+    std::vector<BBox> bin_box(n_bins);
+    std::vector<size_t> bin_count(n_bins);
+    std::vector<float> right_cost(n_bins);
+
+    auto bin_of = [&](const Build_Ref& ref, int axis) {
+        float extent = cbox.max[axis] - cbox.min[axis];
+        size_t b = (size_t)((ref.center[axis] - cbox.min[axis]) / extent * n_bins);
+        return std::min(b, n_bins - 1);
+    };
+
+    // Past this depth we fall back to median splits, which bounds the tree depth
+    // (and hence the traversal stack) even for pathological inputs.
+    bool use_sah = depth < max_sah_depth;
+
+    for(int axis = 0; use_sah && axis < 3; axis++) {
+
+        if(cbox.max[axis] <= cbox.min[axis]) continue;
+
+        std::fill(bin_box.begin(), bin_box.end(), BBox());
+        std::fill(bin_count.begin(), bin_count.end(), size_t(0));
+
+        for(size_t i = start; i < end; i++) {
+            size_t b = bin_of(refs[i], axis);
+            bin_box[b].enclose(refs[i].box);
+            bin_count[b]++;
+        }
+
+        BBox acc;
+        size_t count = 0;
+        for(size_t b = n_bins - 1; b > 0; b--) {
+            acc.enclose(bin_box[b]);
+            count += bin_count[b];
+            right_cost[b] = count ? acc.surface_area() * count : -1.0f;
+        }
+
+        acc.reset();
+        count = 0;
+        for(size_t b = 0; b < n_bins - 1; b++) {
+            acc.enclose(bin_box[b]);
+            count += bin_count[b];
+            if(count == 0 || right_cost[b + 1] < 0.0f) continue;
+
+            float cost = acc.surface_area() * count + right_cost[b + 1];
+            if(cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = b + 1;
+            }
+        }
+    }
+
+    size_t mid = start;
+    if(best_axis >= 0) {
+
+        float split_cost = opt.traversal_cost + opt.intersection_cost * best_cost * inv_area;
+        float leaf_cost = opt.intersection_cost * n;
+        if(n <= opt.max_leaf_size && leaf_cost <= split_cost) return idx;
+
+        auto part = std::partition(refs.begin() + start, refs.begin() + end,
+                                   [&](const Build_Ref& ref) {
+                                       return bin_of(ref, best_axis) < best_split;
+                                   });
+        mid = part - refs.begin();
+
+    } else {
+
+        if(n <= opt.max_leaf_size) return idx;
+
+        // All centroids coincide (or we are too deep): split the range in half along
+        // the longest axis.
+        Vec3 extent = box.max - box.min;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+                                       : (extent.y > extent.z ? 1 : 2);
+        mid = start + n / 2;
+        std::nth_element(refs.begin() + start, refs.begin() + mid, refs.begin() + end,
+                         [axis](const Build_Ref& a, const Build_Ref& b) {
+                             return a.center[axis] < b.center[axis];
+                         });
+    }
+
+    // Large subtrees near the root are handed off to the pool; the left child is always
+    // built in place so that it directly follows its parent.
+    size_t r;
+    if(opt.pool && end - mid >= parallel_build_size) {
+
+        auto right = opt.pool->enqueue([&refs, mid, end, &opt, depth]() {
+            std::vector<Node> sub;
+            build_range(sub, refs, mid, end, opt, depth + 1);
+            return sub;
+        });
+
+        build_range(out, refs, start, mid, opt, depth + 1);
+        std::vector<Node> sub = opt.pool->wait_on(right);
+
+        r = out.size();
+        for(Node& node : sub) {
+            if(!node.is_leaf()) node.offset += (uint32_t)r;
+            out.push_back(node);
+        }
+
+    } else {
+        build_range(out, refs, start, mid, opt, depth + 1);
+        r = build_range(out, refs, mid, end, opt, depth + 1);
+    }
+
+    out[idx].offset = (uint32_t)r;
+    out[idx].size = 0;
+    return idx;
+}
+
+template<typename Primitive> void BVH<Primitive>::compute_stats(const BVH_Options& opt) {
 
-    // TODO (PathTracer): Task 3
-    // Construct a BVH from the given vector of primitives and maximum leaf
-    // size configuration. The starter code builds a BVH with a
-    // single leaf node (which is also the root) that encloses all the
-    // primitives.
+    build_stats.nodes = nodes.size();
+    build_stats.leaves = 0;
+    build_stats.primitives = primitives.size();
 
-    // Replace these
+    float root_area = nodes[root_idx].bbox.surface_area();
+    float cost = 0.0f;
+    for(const Node& node : nodes) {
+        float area = node.bbox.surface_area();
+        if(node.is_leaf()) {
+            build_stats.leaves++;
+            cost += opt.intersection_cost * node.size * area;
+        } else {
+            cost += opt.traversal_cost * area;
+        }
+    }
+    build_stats.sah_cost = root_area > 0.0f ? cost / root_area : 0.0f;
+}
+
+template<typename Primitive>
+BBox BVH<Primitive>::leaf_bbox(uint32_t start, uint32_t size) const {
     BBox box;
-    for(const Primitive& prim : primitives) box.enclose(prim.bbox());
+    for(uint32_t i = start; i < start + size; i++) box.enclose(primitives[i].bbox());
+    return box;
+}
 
-    new_node(box, 0, primitives.size(), 0, 0);
-    root_idx = 0;
+template<typename Primitive> float BVH<Primitive>::sah_cost() const {
+
+#if SCOTTY3D_BVH_WIDTH > 2
+    if(wide_nodes.empty()) return 0.0f;
+
+    // Every child box is charged to the node holding it: leaves cost their primitives,
+    // interior children cost one more node visit.
+    float root_area = wide_bbox(wide_nodes[0]).surface_area();
+    float cost = options.traversal_cost * root_area;
+    for(const Wide_Node& node : wide_nodes) {
+        for(size_t i = 0; i < width; i++) {
+            if(node.child[i] == empty_slot) continue;
+            float area = slot_bbox(node, i).surface_area();
+            if(node.size[i] > 0) {
+                cost += options.intersection_cost * node.size[i] * area;
+            } else {
+                cost += options.traversal_cost * area;
+            }
+        }
+    }
+#else
+    if(nodes.empty()) return 0.0f;
+
+    float root_area = nodes[root_idx].bbox.surface_area();
+    float cost = 0.0f;
+    for(const Node& node : nodes) {
+        float area = node.bbox.surface_area();
+        if(node.is_leaf()) {
+            cost += options.intersection_cost * node.size * area;
+        } else {
+            cost += options.traversal_cost * area;
+        }
+    }
+#endif
+    return root_area > 0.0f ? cost / root_area : 0.0f;
+}
+
+template<typename Primitive> bool BVH<Primitive>::refit(Thread_Pool* pool) {
+
+    // Both layouts store every child after its parent, so walking the nodes backwards
+    // updates children before the parents that enclose them.
+
+#if SCOTTY3D_BVH_WIDTH > 2
+    for(size_t w = wide_nodes.size(); w-- > 0;) {
+        Wide_Node& node = wide_nodes[w];
+        for(size_t i = 0; i < width; i++) {
+            if(node.child[i] == empty_slot) continue;
+            BBox box = node.size[i] > 0 ? leaf_bbox(node.child[i], node.size[i])
+                                        : wide_bbox(wide_nodes[node.child[i]]);
+            for(size_t a = 0; a < 3; a++) {
+                node.bounds[a][i] = box.min.data[a];
+                node.bounds[a + 3][i] = box.max.data[a];
+            }
+        }
+    }
+#else
+    for(size_t i = nodes.size(); i-- > 0;) {
+        Node& node = nodes[i];
+        if(node.is_leaf()) {
+            node.bbox = leaf_bbox(node.offset, node.size);
+        } else {
+            node.bbox = nodes[i + 1].bbox;
+            node.bbox.enclose(nodes[node.offset].bbox);
+        }
+    }
+#endif
+
+    // Boxes of primitives that moved apart overlap more and more; past the threshold a
+    // fresh build is cheaper than continuing to trace through the stretched tree.
+    if(sah_cost() > options.refit_rebuild_ratio * built_cost) {
+        BVH_Options opt = options;
+        opt.pool = pool;
+        build(destructure(), opt);
+        return false;
+    }
+    return true;
+}
+
+#if SCOTTY3D_BVH_WIDTH > 2
+
+template<typename Primitive> BBox BVH<Primitive>::slot_bbox(const Wide_Node& node, size_t i) {
+    return BBox(Vec3(node.bounds[0][i], node.bounds[1][i], node.bounds[2][i]),
+                Vec3(node.bounds[3][i], node.bounds[4][i], node.bounds[5][i]));
+}
+
+template<typename Primitive> BBox BVH<Primitive>::wide_bbox(const Wide_Node& node) {
+    BBox box;
+    for(size_t i = 0; i < width; i++) {
+        if(node.child[i] == empty_slot) continue;
+        box.enclose(slot_bbox(node, i));
+    }
+    return box;
+}
+
+template<typename Primitive> void BVH<Primitive>::collapse() {
+
+    // Only the wide nodes are used after this, so the binary tree is dropped.
+    wide_nodes.clear();
+    if(!nodes.empty()) collapse_node(root_idx);
+    nodes.clear();
+    nodes.shrink_to_fit();
+}
+
+template<typename Primitive> uint32_t BVH<Primitive>::collapse_node(size_t idx) {
+
+    // Pull grandchildren up into this node until it has `width` children, always
+    // opening the interior child with the largest surface area.
+    size_t children[width];
+    size_t n = 0;
+
+    if(nodes[idx].is_leaf()) {
+        children[n++] = idx;
+    } else {
+        children[n++] = idx + 1;
+        children[n++] = nodes[idx].offset;
+        while(n < width) {
+            int best = -1;
+            float best_area = -1.0f;
+            for(size_t i = 0; i < n; i++) {
+                const Node& c = nodes[children[i]];
+                if(!c.is_leaf() && c.bbox.surface_area() > best_area) {
+                    best = (int)i;
+                    best_area = c.bbox.surface_area();
+                }
+            }
+            if(best < 0) break;
+            size_t open = children[best];
+            children[best] = open + 1;
+            children[n++] = nodes[open].offset;
+        }
+    }
+
+    uint32_t w = (uint32_t)wide_nodes.size();
+    wide_nodes.emplace_back();
+    for(size_t i = 0; i < width; i++) {
+        for(size_t a = 0; a < 3; a++) {
+            wide_nodes[w].bounds[a][i] = FLT_MAX;
+            wide_nodes[w].bounds[a + 3][i] = -FLT_MAX;
+        }
+        wide_nodes[w].child[i] = empty_slot;
+        wide_nodes[w].size[i] = 0;
+    }
+
+    for(size_t i = 0; i < n; i++) {
+        const Node& c = nodes[children[i]];
+        uint32_t child = c.is_leaf() ? c.offset : collapse_node(children[i]);
+
+        // collapse_node may have grown wide_nodes, so index it again
+        Wide_Node& node = wide_nodes[w];
+        for(size_t a = 0; a < 3; a++) {
+            node.bounds[a][i] = c.bbox.min.data[a];
+            node.bounds[a + 3][i] = c.bbox.max.data[a];
+        }
+        node.child[i] = child;
+        node.size[i] = c.size;
+    }
+    return w;
+}
+
+template<typename Primitive>
+unsigned int BVH<Primitive>::hit_children(const Wide_Node& node, const Ray& ray, const Vec3& inv,
+                                          float* tmin) {
+
+    // Slab test against every child at once. For each axis the near plane is picked
+    // by the sign of the direction, and max/min take the running interval as their
+    // second operand, which SSE/AVX return when the other operand is NaN.
+
+#if SCOTTY3D_BVH_WIDTH == 4 && (defined(__SSE__) || defined(_M_X64))
+
+    __m128 lo = _mm_set1_ps(ray.dist_bounds.x);
+    __m128 hi = _mm_set1_ps(ray.dist_bounds.y);
+    for(int a = 0; a < 3; a++) {
+        int near = inv.data[a] < 0.0f ? 3 : 0;
+        __m128 o = _mm_set1_ps(ray.point.data[a]);
+        __m128 d = _mm_set1_ps(inv.data[a]);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[a + near]), o), d);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[a + 3 - near]), o), d);
+        lo = _mm_max_ps(t0, lo);
+        hi = _mm_min_ps(t1, hi);
+    }
+    _mm_storeu_ps(tmin, lo);
+    return (unsigned int)_mm_movemask_ps(_mm_cmple_ps(lo, hi));
+
+#elif SCOTTY3D_BVH_WIDTH == 8 && defined(__AVX__)
+
+    __m256 lo = _mm256_set1_ps(ray.dist_bounds.x);
+    __m256 hi = _mm256_set1_ps(ray.dist_bounds.y);
+    for(int a = 0; a < 3; a++) {
+        int near = inv.data[a] < 0.0f ? 3 : 0;
+        __m256 o = _mm256_set1_ps(ray.point.data[a]);
+        __m256 d = _mm256_set1_ps(inv.data[a]);
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[a + near]), o), d);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[a + 3 - near]), o), d);
+        lo = _mm256_max_ps(t0, lo);
+        hi = _mm256_min_ps(t1, hi);
+    }
+    _mm256_storeu_ps(tmin, lo);
+    return (unsigned int)_mm256_movemask_ps(_mm256_cmp_ps(lo, hi, _CMP_LE_OQ));
+
+#else
+
+    unsigned int mask = 0;
+    for(size_t i = 0; i < width; i++) {
+        float lo = ray.dist_bounds.x, hi = ray.dist_bounds.y;
+        for(int a = 0; a < 3; a++) {
+            int near = inv.data[a] < 0.0f ? 3 : 0;
+            float t0 = (node.bounds[a + near][i] - ray.point.data[a]) * inv.data[a];
+            float t1 = (node.bounds[a + 3 - near][i] - ray.point.data[a]) * inv.data[a];
+            lo = t0 > lo ? t0 : lo;
+            hi = t1 < hi ? t1 : hi;
+        }
+        tmin[i] = lo;
+        if(lo <= hi) mask |= 1u << i;
+    }
+    return mask;
+
+#endif
+}
+
+template<typename Primitive> Hit BVH<Primitive>::hit(const Ray& ray) const {
+
+    Hit ret;
+    if(wide_nodes.empty()) return ret;
+
+    Vec3 inv(1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z);
+
+    // Entries are either wide nodes (size == 0) or leaves, along with the distance at
+    // which the ray enters them.
+    struct Entry {
+        uint32_t child, size;
+        float t;
+    };
+    Entry stack[max_depth * width];
+    size_t top = 0;
+    stack[top++] = {0, 0, ray.dist_bounds.x};
+
+    Vec2 bounds = ray.dist_bounds;
+
+    while(top) {
+
+        Entry entry = stack[--top];
+        if(entry.t > ray.dist_bounds.y) continue;
+
+        if(entry.size > 0) {
+            for(uint32_t i = entry.child; i < entry.child + entry.size; i++) {
+                Hit hit = primitives[i].hit(ray);
+                if(hit.hit && hit.distance <= ray.dist_bounds.y) {
+                    ret = Hit::min(ret, hit);
+                    ray.dist_bounds.y = ret.distance;
+                }
+            }
+            continue;
+        }
+
+        const Wide_Node& node = wide_nodes[entry.child];
+        alignas(32) float tmin[width];
+        unsigned int mask = hit_children(node, ray, inv, tmin);
+
+        // Push hit children farthest first so the nearest is visited next
+        Entry hits[width];
+        size_t n = 0;
+        for(size_t i = 0; i < width; i++) {
+            if(!(mask & (1u << i))) continue;
+            Entry e = {node.child[i], node.size[i], tmin[i]};
+            size_t j = n++;
+            for(; j > 0 && hits[j - 1].t < e.t; j--) hits[j] = hits[j - 1];
+            hits[j] = e;
+        }
+        for(size_t i = 0; i < n; i++) stack[top++] = hits[i];
+    }
+
+    ray.dist_bounds = bounds;
+    return ret;
+}
+
+template<typename Primitive>
+void BVH<Primitive>::hit(const Ray_Packet& packet, unsigned int mask, Hit* ret) const {
+
+    if(wide_nodes.empty() || !mask) return;
+
+    Vec3 inv[Ray_Packet::size];
+    for(size_t r = 0; r < packet.count; r++) {
+        const Vec3& d = packet.rays[r].dir;
+        inv[r] = Vec3(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+    }
+
+    // As in the single-ray traversal, but each entry carries the lanes that reached it,
+    // where each of them enters it, and the nearest of those distances for ordering.
+    // Every node is loaded once per packet and then slab-tested against each of its rays.
+    struct Entry {
+        uint32_t child, size;
+        unsigned int mask;
+        float t;
+        float lane_t[Ray_Packet::size];
+    };
+    Entry stack[max_depth * width];
+    size_t top = 0;
+    stack[top] = {0, 0, mask, -FLT_MAX, {}};
+    std::fill(stack[top].lane_t, stack[top].lane_t + Ray_Packet::size, -FLT_MAX);
+    top++;
+
+    while(top) {
+
+        Entry entry = stack[--top];
+
+        // Lanes that found a closer hit since the entry was pushed no longer need it
+        for(size_t r = 0; r < packet.count; r++) {
+            if(entry.lane_t[r] > packet.rays[r].dist_bounds.y) entry.mask &= ~(1u << r);
+        }
+        if(!entry.mask) continue;
+
+        if(entry.size > 0) {
+            for(uint32_t i = entry.child; i < entry.child + entry.size; i++) {
+                primitives[i].hit(packet, entry.mask, ret);
+            }
+            continue;
+        }
+
+        const Wide_Node& node = wide_nodes[entry.child];
+        Entry children[width];
+        for(size_t i = 0; i < width; i++) {
+            children[i] = {node.child[i], node.size[i], 0u, FLT_MAX, {}};
+        }
+
+        for(size_t r = 0; r < packet.count; r++) {
+            if(!(entry.mask & (1u << r))) continue;
+            alignas(32) float tmin[width];
+            unsigned int m = hit_children(node, packet.rays[r], inv[r], tmin);
+            for(size_t i = 0; i < width; i++) {
+                if(!(m & (1u << i))) continue;
+                children[i].mask |= 1u << r;
+                children[i].t = std::min(children[i].t, tmin[i]);
+                children[i].lane_t[r] = tmin[i];
+            }
+        }
+
+        Entry hits[width];
+        size_t n = 0;
+        for(size_t i = 0; i < width; i++) {
+            if(!children[i].mask) continue;
+            const Entry& e = children[i];
+            size_t j = n++;
+            for(; j > 0 && hits[j - 1].t < e.t; j--) hits[j] = hits[j - 1];
+            hits[j] = e;
+        }
+        for(size_t i = 0; i < n; i++) stack[top++] = hits[i];
+    }
+}
+
+template<typename Primitive> bool BVH<Primitive>::occluded(const Ray& ray) const {
+
+    if(wide_nodes.empty()) return false;
+
+    Vec3 inv(1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z);
+
+    // Any hit will do, so there is no need to order children or to track distances
+    struct Entry {
+        uint32_t child, size;
+    };
+    Entry stack[max_depth * width];
+    size_t top = 0;
+    stack[top++] = {0, 0};
+
+    while(top) {
+
+        Entry entry = stack[--top];
+
+        if(entry.size > 0) {
+            for(uint32_t i = entry.child; i < entry.child + entry.size; i++) {
+                if(primitives[i].occluded(ray)) return true;
+            }
+            continue;
+        }
+
+        const Wide_Node& node = wide_nodes[entry.child];
+        alignas(32) float tmin[width];
+        unsigned int mask = hit_children(node, ray, inv, tmin);
+        for(size_t i = 0; i < width; i++) {
+            if(mask & (1u << i)) stack[top++] = {node.child[i], node.size[i]};
+        }
+    }
+    return false;
+}
+
+template<typename Primitive>
+template<typename F>
+void BVH<Primitive>::visit(const Ray& ray, F&& f) const {
+
+    if(wide_nodes.empty()) return;
+
+    Vec3 inv(1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z);
+
+    struct Entry {
+        uint32_t child, size;
+    };
+    Entry stack[max_depth * width];
+    size_t top = 0;
+    stack[top++] = {0, 0};
+
+    while(top) {
+
+        Entry entry = stack[--top];
+
+        if(entry.size > 0) {
+            for(uint32_t i = entry.child; i < entry.child + entry.size; i++) f(primitives[i]);
+            continue;
+        }
+
+        const Wide_Node& node = wide_nodes[entry.child];
+        alignas(32) float tmin[width];
+        unsigned int mask = hit_children(node, ray, inv, tmin);
+        for(size_t i = 0; i < width; i++) {
+            if(mask & (1u << i)) stack[top++] = {node.child[i], node.size[i]};
+        }
+    }
 }
 
-template<typename Primitive> Trace BVH<Primitive>::hit(const Ray& ray) const {
+#else
+
+template<typename Primitive> Hit BVH<Primitive>::hit(const Ray& ray) const {
+
+    Hit ret;
+    if(nodes.empty()) return ret;
+
+    Vec2 times = ray.dist_bounds;
+    if(!nodes[root_idx].bbox.hit(ray, times)) return ret;
+
+    // Each entry remembers where the ray enters the node, so subtrees that start beyond
+    // the closest hit found so far can be skipped without re-testing their boxes.
+    struct Entry {
+        uint32_t idx;
+        float t;
+    };
+    Entry stack[max_depth];
+    size_t top = 0;
+    stack[top++] = {(uint32_t)root_idx, times.x};
 
-    // TODO (PathTracer): Task 3
-    // Implement ray - BVH intersection test. A ray intersects
-    // with a BVH aggregate if and only if it intersects a primitive in
-    // the BVH that is not an aggregate.
+    // Shrinking the ray's far bound lets primitives reject farther hits early;
+    // the caller's bounds are restored before returning.
+    Vec2 bounds = ray.dist_bounds;
 
-    // The starter code simply iterates through all the primitives.
-    // Again, remember you can use hit() on any Primitive value.
+    while(top) {
+
+        Entry entry = stack[--top];
+        if(entry.t > ray.dist_bounds.y) continue;
+
+        const Node& node = nodes[entry.idx];
+
+        if(node.is_leaf()) {
+            for(uint32_t i = node.offset; i < node.offset + node.size; i++) {
+                Hit hit = primitives[i].hit(ray);
+                if(hit.hit && hit.distance <= ray.dist_bounds.y) {
+                    ret = Hit::min(ret, hit);
+                    ray.dist_bounds.y = ret.distance;
+                }
+            }
+            continue;
+        }
 
-    Trace ret;
-    for(const Primitive& prim : primitives) {
-        Trace hit = prim.hit(ray);
-        ret = Trace::min(ret, hit);
+        uint32_t l = entry.idx + 1, r = node.offset;
+        Vec2 tl = ray.dist_bounds, tr = ray.dist_bounds;
+        bool hl = nodes[l].bbox.hit(ray, tl);
+        bool hr = nodes[r].bbox.hit(ray, tr);
+
+        // Visit the nearer child first by pushing it last
+        if(hl && hr) {
+            if(tl.x <= tr.x) {
+                stack[top++] = {r, tr.x};
+                stack[top++] = {l, tl.x};
+            } else {
+                stack[top++] = {l, tl.x};
+                stack[top++] = {r, tr.x};
+            }
+        } else if(hl) {
+            stack[top++] = {l, tl.x};
+        } else if(hr) {
+            stack[top++] = {r, tr.x};
+        }
     }
+
+    ray.dist_bounds = bounds;
     return ret;
 }
 
+template<typename Primitive>
+void BVH<Primitive>::hit(const Ray_Packet& packet, unsigned int mask, Hit* ret) const {
+
+    if(nodes.empty() || !mask) return;
+
+    struct Entry {
+        uint32_t idx;
+        unsigned int mask;
+        float t;
+    };
+    Entry stack[max_depth];
+    size_t top = 0;
+    stack[top++] = {(uint32_t)root_idx, mask, -FLT_MAX};
+
+    while(top) {
+
+        Entry entry = stack[--top];
+        const Node& node = nodes[entry.idx];
+
+        if(node.is_leaf()) {
+            for(uint32_t i = node.offset; i < node.offset + node.size; i++) {
+                primitives[i].hit(packet, entry.mask, ret);
+            }
+            continue;
+        }
+
+        uint32_t l = entry.idx + 1, r = node.offset;
+        unsigned int ml = 0, mr = 0;
+        float tl = FLT_MAX, tr = FLT_MAX;
+
+        for(size_t i = 0; i < packet.count; i++) {
+            if(!(entry.mask & (1u << i))) continue;
+            const Ray& ray = packet.rays[i];
+            Vec2 times = ray.dist_bounds;
+            if(nodes[l].bbox.hit(ray, times)) {
+                ml |= 1u << i;
+                tl = std::min(tl, times.x);
+            }
+            times = ray.dist_bounds;
+            if(nodes[r].bbox.hit(ray, times)) {
+                mr |= 1u << i;
+                tr = std::min(tr, times.x);
+            }
+        }
+
+        if(ml && mr) {
+            if(tl <= tr) {
+                stack[top++] = {r, mr, tr};
+                stack[top++] = {l, ml, tl};
+            } else {
+                stack[top++] = {l, ml, tl};
+                stack[top++] = {r, mr, tr};
+            }
+        } else if(ml) {
+            stack[top++] = {l, ml, tl};
+        } else if(mr) {
+            stack[top++] = {r, mr, tr};
+        }
+    }
+}
+
+template<typename Primitive> bool BVH<Primitive>::occluded(const Ray& ray) const {
+
+    if(nodes.empty()) return false;
+
+    Vec2 times = ray.dist_bounds;
+    if(!nodes[root_idx].bbox.hit(ray, times)) return false;
+
+    // Any hit will do, so there is no need to order children or to track distances
+    uint32_t stack[max_depth];
+    size_t top = 0;
+    stack[top++] = (uint32_t)root_idx;
+
+    while(top) {
+
+        uint32_t idx = stack[--top];
+        const Node& node = nodes[idx];
+
+        if(node.is_leaf()) {
+            for(uint32_t i = node.offset; i < node.offset + node.size; i++) {
+                if(primitives[i].occluded(ray)) return true;
+            }
+            continue;
+        }
+
+        uint32_t l = idx + 1, r = node.offset;
+        Vec2 tl = ray.dist_bounds, tr = ray.dist_bounds;
+        if(nodes[l].bbox.hit(ray, tl)) stack[top++] = l;
+        if(nodes[r].bbox.hit(ray, tr)) stack[top++] = r;
+    }
+    return false;
+}
+
+template<typename Primitive>
+template<typename F>
+void BVH<Primitive>::visit(const Ray& ray, F&& f) const {
+
+    if(nodes.empty()) return;
+
+    Vec2 times = ray.dist_bounds;
+    if(!nodes[root_idx].bbox.hit(ray, times)) return;
+
+    uint32_t stack[max_depth];
+    size_t top = 0;
+    stack[top++] = (uint32_t)root_idx;
+
+    while(top) {
+
+        uint32_t idx = stack[--top];
+        const Node& node = nodes[idx];
+
+        if(node.is_leaf()) {
+            for(uint32_t i = node.offset; i < node.offset + node.size; i++) f(primitives[i]);
+            continue;
+        }
+
+        uint32_t l = idx + 1, r = node.offset;
+        Vec2 tl = ray.dist_bounds, tr = ray.dist_bounds;
+        if(nodes[l].bbox.hit(ray, tl)) stack[top++] = l;
+        if(nodes[r].bbox.hit(ray, tr)) stack[top++] = r;
+    }
+}
+
+#endif
+
 template<typename Primitive>
 BVH<Primitive>::BVH(std::vector<Primitive>&& prims, size_t max_leaf_size) {
     build(std::move(prims), max_leaf_size);
 }
 
+template<typename Primitive>
+BVH<Primitive>::BVH(std::vector<Primitive>&& prims, const BVH_Options& opt) {
+    build(std::move(prims), opt);
+}
+
 template<typename Primitive> BVH<Primitive> BVH<Primitive>::copy() const {
     BVH<Primitive> ret;
     ret.nodes = nodes;
+#if SCOTTY3D_BVH_WIDTH > 2
+    ret.wide_nodes = wide_nodes;
+#endif
     ret.primitives = primitives;
     ret.root_idx = root_idx;
+    ret.build_stats = build_stats;
+    ret.options = options;
+    ret.built_cost = built_cost;
     return ret;
 }
 
 template<typename Primitive> bool BVH<Primitive>::Node::is_leaf() const {
-
-    // A node is a leaf if l == r, since all interior nodes must have distinct children
-    return l == r;
-}
-
-template<typename Primitive>
-size_t BVH<Primitive>::new_node(BBox box, size_t start, size_t size, size_t l, size_t r) {
-    Node n;
-    n.bbox = box;
-    n.start = start;
-    n.size = size;
-    n.l = l;
-    n.r = r;
-    nodes.push_back(n);
-    return nodes.size() - 1;
+    return size > 0;
 }
 
 template<typename Primitive> BBox BVH<Primitive>::bbox() const {
+#if SCOTTY3D_BVH_WIDTH > 2
+    if(wide_nodes.empty()) return {};
+    return wide_bbox(wide_nodes[0]);
+#else
+    if(nodes.empty()) return {};
     return nodes[root_idx].bbox;
+#endif
 }
 
 template<typename Primitive> std::vector<Primitive> BVH<Primitive>::destructure() {
     nodes.clear();
+#if SCOTTY3D_BVH_WIDTH > 2
+    wide_nodes.clear();
+#endif
     return std::move(primitives);
 }
 
 template<typename Primitive> void BVH<Primitive>::clear() {
     nodes.clear();
+#if SCOTTY3D_BVH_WIDTH > 2
+    wide_nodes.clear();
+#endif
     primitives.clear();
 }
 
@@ -112,23 +919,10 @@ template<typename Primitive>
 size_t BVH<Primitive>::visualize(GL::Lines& lines, GL::Lines& active, size_t level,
                                  const Mat4& trans) const {
 
-    std::stack<std::pair<size_t, size_t>> tstack;
-    tstack.push({root_idx, 0});
-    size_t max_level = 0;
-
-    if(nodes.empty()) return max_level;
-
-    while(!tstack.empty()) {
-
-        auto [idx, lvl] = tstack.top();
-        max_level = std::max(max_level, lvl);
-        const Node& node = nodes[idx];
-        tstack.pop();
-
+    auto draw = [&](BBox box, size_t lvl) {
         Vec3 color = lvl == level ? Vec3(1.0f, 0.0f, 0.0f) : Vec3(1.0f);
         GL::Lines& add = lvl == level ? active : lines;
 
-        BBox box = node.bbox;
         box.transform(trans);
         Vec3 min = box.min, max = box.max;
 
@@ -146,17 +940,72 @@ size_t BVH<Primitive>::visualize(GL::Lines& lines, GL::Lines& active, size_t lev
         edge(Vec3{min.x, min.y, max.z}, Vec3{min.x, max.y, max.z});
         edge(Vec3{max.x, min.y, min.z}, Vec3{max.x, max.y, min.z});
         edge(Vec3{max.x, min.y, min.z}, Vec3{max.x, min.y, max.z});
+    };
+
+    size_t max_level = 0;
+    auto leaf = [&](size_t start, size_t size, size_t lvl) {
+        for(size_t i = start; i < start + size; i++) {
+            size_t c = primitives[i].visualize(lines, active, level - lvl, trans);
+            max_level = std::max(c + lvl, max_level);
+        }
+    };
+
+#if SCOTTY3D_BVH_WIDTH > 2
+
+    if(wide_nodes.empty()) return max_level;
+
+    // (child, size, level) as in the traversal stack, plus the child's box
+    std::stack<std::tuple<uint32_t, uint32_t, size_t, BBox>> tstack;
+    tstack.push({0, 0, 0, bbox()});
+
+    while(!tstack.empty()) {
+
+        auto [child, size, lvl, box] = tstack.top();
+        max_level = std::max(max_level, lvl);
+        tstack.pop();
+
+        draw(box, lvl);
+
+        if(size > 0) {
+            leaf(child, size, lvl);
+            continue;
+        }
+
+        const Wide_Node& node = wide_nodes[child];
+        for(size_t i = 0; i < width; i++) {
+            if(node.child[i] == empty_slot) continue;
+            BBox cbox(Vec3(node.bounds[0][i], node.bounds[1][i], node.bounds[2][i]),
+                      Vec3(node.bounds[3][i], node.bounds[4][i], node.bounds[5][i]));
+            tstack.push({node.child[i], node.size[i], lvl + 1, cbox});
+        }
+    }
+
+#else
+
+    if(nodes.empty()) return max_level;
+
+    std::stack<std::pair<size_t, size_t>> tstack;
+    tstack.push({root_idx, 0});
+
+    while(!tstack.empty()) {
+
+        auto [idx, lvl] = tstack.top();
+        max_level = std::max(max_level, lvl);
+        const Node& node = nodes[idx];
+        tstack.pop();
+
+        draw(node.bbox, lvl);
 
         if(!node.is_leaf()) {
-            tstack.push({node.l, lvl + 1});
-            tstack.push({node.r, lvl + 1});
+            tstack.push({idx + 1, lvl + 1});
+            tstack.push({node.offset, lvl + 1});
         } else {
-            for(size_t i = node.start; i < node.start + node.size; i++) {
-                size_t c = primitives[i].visualize(lines, active, level - lvl, trans);
-                max_level = std::max(c + lvl, max_level);
-            }
+            leaf(node.offset, node.size, lvl);
         }
     }
+
+#endif
+
     return max_level;
 }
 
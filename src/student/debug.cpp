@@ -1,6 +1,9 @@
 
 #include "debug.h"
+
+#ifndef SCOTTY3D_HEADLESS
 #include <imgui/imgui.h>
+#endif
 
 #include "../lib/log.h"
 #include "../lib/spectrum.h"
@@ -36,6 +39,8 @@ Debug_Data debug_data;
     Some useful functions are documented below, and you can refer to
     deps/imgui/imgui.h for many more.
 */
+// Headless builds have no UI, so anything in here is left out of them
+#ifndef SCOTTY3D_HEADLESS
 void student_debug_ui() {
     using namespace ImGui;
 
@@ -60,3 +65,4 @@ void student_debug_ui() {
     static Spectrum color = Spectrum(1.0f);
     ColorEdit3("Color Input", color.data);
 }
+#endif
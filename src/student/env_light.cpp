@@ -5,24 +5,28 @@
 
 namespace PT {
 
+Env_Map::Env_Map(HDR_Image&& img, Thread_Pool* pool)
+    : image(std::move(img)), image_sampler(image) {
+
+    auto [w, h] = image.dimension();
+    std::vector<float> luma(w * h);
+    for(size_t i = 0; i < luma.size(); i++) luma[i] = image.at(i).luma();
+    alias_sampler = Samplers::Sphere::Image_Alias(luma, w, h, pool);
+}
+
 Vec3 Env_Map::sample() const {
 
-    // TODO (PathTracer): Task 7
+    // NOTE (PathTracer): Task 7
 
-    // First, implement Samplers::Sphere::Uniform so the following line works.
-    // Second, implement Samplers::Sphere::Image and swap to image_sampler
+    // Directions are importance sampled with alias_sampler, which draws a texel in
+    // constant time. Samplers::Sphere::Image is the same distribution built on a CDF
+    // and binary search, if you'd like to implement it yourself and compare.
 
-    return uniform_sampler.sample();
+    return alias_sampler.sample();
 }
 
 float Env_Map::pdf(Vec3 dir) const {
-
-    // TODO (PathTracer): Task 7
-
-    // First, return the pdf for a uniform spherical distribution.
-    // Second, swap to image_sampler.pdf().
-
-    return 0.0f;
+    return alias_sampler.pdf(dir);
 }
 
 Spectrum Env_Map::evaluate(Vec3 dir) const {
@@ -31,7 +35,8 @@ Spectrum Env_Map::evaluate(Vec3 dir) const {
 
     // Compute emitted radiance along a given direction by finding the corresponding
     // pixels in the enviornment image. You should bi-linearly interpolate the value
-    // between the 4 nearest pixels.
+    // between the 4 nearest pixels. Use the same mapping from directions to pixels as
+    // Samplers::Sphere::Image_Alias, so that sampling matches the emitted radiance.
 
     return Spectrum{};
 }
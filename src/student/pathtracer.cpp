@@ -6,11 +6,11 @@
 
 namespace PT {
 
-Spectrum Pathtracer::trace_pixel(size_t x, size_t y) {
+Ray Pathtracer::pixel_ray(size_t x, size_t y) {
 
     // TODO (PathTracer): Task 1
 
-    // Generate a ray that uniformly samples pixel (x,y) and return the incoming light.
+    // Generate a ray that uniformly samples pixel (x,y).
     // The following code generates a ray at the bottom left of the pixel every time.
 
     // Tip: Samplers::Rect
@@ -21,9 +21,13 @@ Spectrum Pathtracer::trace_pixel(size_t x, size_t y) {
 
     Ray ray = camera.generate_ray(xy / wh);
     ray.depth = max_depth;
+    return ray;
+}
+
+Spectrum Pathtracer::trace_pixel(size_t x, size_t y) {
 
     // Pathtracer::trace() returns the incoming light split into emissive and reflected components.
-    auto [emissive, reflected] = trace(ray);
+    auto [emissive, reflected] = trace(pixel_ray(x, y));
     return emissive + reflected;
 }
 
@@ -100,7 +104,14 @@ std::pair<Spectrum, Spectrum> Pathtracer::trace(const Ray& ray) {
     // surface the ray hits, and reflected through that point from other sources.
 
     // Trace ray into scene.
-    Trace result = scene.hit(ray);
+    return trace(ray, scene.finalize(ray, scene.hit(ray)));
+}
+
+std::pair<Spectrum, Spectrum> Pathtracer::trace(const Ray& ray, Trace result) {
+
+    // Shade a ray whose intersection with the scene has already been found, either by
+    // Pathtracer::trace() above or by a packet query over several camera rays.
+
     if(!result.hit) {
 
         // If no surfaces were hit, sample the environemnt map.
@@ -127,6 +138,10 @@ std::pair<Spectrum, Spectrum> Pathtracer::trace(const Ray& ray) {
     // If the ray has reached maximum depth, stop tracing
     if(ray.depth == 0) return {};
 
+    // Each vertex of the path draws from its own random sequence (the camera ray used
+    // sequence 0), so a vertex doesn't depend on how many numbers earlier ones used
+    RNG::bounce((uint32_t)(max_depth - ray.depth) + 1);
+
     // Set up shading information
     Mat4 object_to_world = Mat4::rotate_to(result.normal);
     Mat4 world_to_object = object_to_world.T();
@@ -9,7 +9,7 @@ Vec2 Rect::sample() const {
     // TODO (PathTracer): Task 1
 
     // Generate a uniformly random point on a rectangle of size size.x * size.y
-    // Tip: RNG::unit()
+    // Tip: RNG::unit2(), which spreads the samples of a pixel evenly over the rectangle
 
     return Vec2{};
 }
@@ -60,8 +60,9 @@ Vec3 Point::sample() const {
 }
 
 Vec3 Triangle::sample() const {
-    float u = std::sqrt(RNG::unit());
-    float v = RNG::unit();
+    Vec2 xi = RNG::unit2();
+    float u = std::sqrt(xi.x);
+    float v = xi.y;
     float a = u * (1.0f - v);
     float b = u * v;
     return a * v0 + b * v1 + (1.0f - a - b) * v2;
@@ -69,8 +70,9 @@ Vec3 Triangle::sample() const {
 
 Vec3 Hemisphere::Uniform::sample() const {
 
-    float Xi1 = RNG::unit();
-    float Xi2 = RNG::unit();
+    Vec2 xi = RNG::unit2();
+    float Xi1 = xi.x;
+    float Xi2 = xi.y;
 
     float theta = std::acos(Xi1);
     float phi = 2.0f * PI_F * Xi2;
@@ -84,8 +86,9 @@ Vec3 Hemisphere::Uniform::sample() const {
 
 Vec3 Hemisphere::Cosine::sample() const {
 
-    float phi = RNG::unit() * 2.0f * PI_F;
-    float cos_t = std::sqrt(RNG::unit());
+    Vec2 xi = RNG::unit2();
+    float phi = xi.x * 2.0f * PI_F;
+    float cos_t = std::sqrt(xi.y);
 
     float sin_t = std::sqrt(1 - cos_t * cos_t);
     float x = std::cos(phi) * sin_t;
@@ -1,53 +1,201 @@
-
 #include "../rays/tri_mesh.h"
 #include "../rays/samplers.h"
 
 namespace PT {
 
-BBox Triangle::bbox() const {
+void Tri_Mesh_Data::precompute() {
+
+    size_t n = triangles();
+    for(int a = 0; a < 3; a++) {
+        p0[a].resize(n);
+        e1[a].resize(n);
+        e2[a].resize(n);
+    }
+
+    for(size_t i = 0; i < n; i++) {
+        Vec3 v_0 = verts[indices[3 * i]].position;
+        Vec3 v_1 = verts[indices[3 * i + 1]].position;
+        Vec3 v_2 = verts[indices[3 * i + 2]].position;
+        for(int a = 0; a < 3; a++) {
+            p0[a][i] = v_0[a];
+            e1[a][i] = v_1[a] - v_0[a];
+            e2[a][i] = v_2[a] - v_0[a];
+        }
+    }
+    areas = {};
+    area = 0.0f;
+}
 
-    // TODO (PathTracer): Task 2
-    // Compute the bounding box of the triangle.
+BBox Triangle::bbox() const {
 
-    // Beware of flat/zero-volume boxes! You may need to
-    // account for that here, or later on in BBox::intersect.
+    // Flat (zero-volume) boxes are fine: BBox::hit treats the slabs as closed intervals.
 
     BBox box;
+    box.enclose(vert(0).position);
+    box.enclose(vert(1).position);
+    box.enclose(vert(2).position);
     return box;
 }
 
-Trace Triangle::hit(const Ray& ray) const {
+Hit Triangle::hit(const Ray& ray) const {
 
-    // Each vertex contains a postion and surface normal
-    Tri_Mesh_Vert v_0 = vertex_list[v0];
-    Tri_Mesh_Vert v_1 = vertex_list[v1];
-    Tri_Mesh_Vert v_2 = vertex_list[v2];
-    (void)v_0;
-    (void)v_1;
-    (void)v_2;
+    // The first vertex and both edges were precomputed by the mesh; the vertex normals
+    // are only read once the closest hit is finalized (see Tri_Mesh::finalize).
+    Vec3 p_0(mesh->p0[0][idx], mesh->p0[1][idx], mesh->p0[2][idx]);
+    Vec3 e1(mesh->e1[0][idx], mesh->e1[1][idx], mesh->e1[2][idx]);
+    Vec3 e2(mesh->e2[0][idx], mesh->e2[1][idx], mesh->e2[2][idx]);
 
-    // TODO (PathTracer): Task 2
-    // Intersect the ray with the triangle defined by the three vertices.
+    // Moller-Trumbore: solve o + t*d = (1-u-v)*p0 + u*p1 + v*p2 with Cramer's rule.
+    // The packet version below performs the same operations lane by lane.
+    Vec3 s = ray.point - p_0;
+    Vec3 s1 = cross(ray.dir, e2);
+    Vec3 s2 = cross(s, e1);
 
-    Trace ret;
-    ret.origin = ray.point;
-    ret.hit = false;       // was there an intersection?
-    ret.distance = 0.0f;   // at what distance did the intersection occur?
-    ret.position = Vec3{}; // where was the intersection?
-    ret.normal = Vec3{};   // what was the surface normal at the intersection?
-                           // (this should be interpolated between the three vertex normals)
+    Hit ret;
+
+    float det = dot(e1, s1);
+    if(det == 0.0f) return ret;
+    float inv = 1.0f / det;
+
+    float u = dot(s, s1) * inv;
+    float v = dot(ray.dir, s2) * inv;
+    float t = dot(e2, s2) * inv;
+
+    if(u < 0.0f || v < 0.0f || u + v > 1.0f) return ret;
+    if(t < ray.dist_bounds.x || t > ray.dist_bounds.y) return ret;
+
+    ret.hit = true;
+    ret.distance = t;
+    ret.primitive = idx;
+    ret.bary = Vec2(u, v);
     return ret;
 }
 
-Triangle::Triangle(Tri_Mesh_Vert* verts, unsigned int v0, unsigned int v1, unsigned int v2)
-    : vertex_list(verts), v0(v0), v1(v1), v2(v2) {
+void Triangle::hit(const Ray_Packet& packet, unsigned int mask, Hit* ret) const {
+
+    Vec3 p_0(mesh->p0[0][idx], mesh->p0[1][idx], mesh->p0[2][idx]);
+    Vec3 e1(mesh->e1[0][idx], mesh->e1[1][idx], mesh->e1[2][idx]);
+    Vec3 e2(mesh->e2[0][idx], mesh->e2[1][idx], mesh->e2[2][idx]);
+
+    alignas(16) float us[Ray_Packet::size], vs[Ray_Packet::size], ts[Ray_Packet::size];
+    unsigned int hits = 0;
+    size_t lane = 0;
+
+#if defined(__SSE__) || defined(_M_X64)
+    // Four lanes at a time: the edge vectors are shared, so the whole test is a handful
+    // of multiply-adds over the packet's SoA origins and directions.
+    __m128 e1x = _mm_set1_ps(e1.x), e1y = _mm_set1_ps(e1.y), e1z = _mm_set1_ps(e1.z);
+    __m128 e2x = _mm_set1_ps(e2.x), e2y = _mm_set1_ps(e2.y), e2z = _mm_set1_ps(e2.z);
+    __m128 p0x = _mm_set1_ps(p_0.x), p0y = _mm_set1_ps(p_0.y), p0z = _mm_set1_ps(p_0.z);
+    __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+
+    for(; lane + 4 <= packet.count; lane += 4) {
+
+        unsigned int group = (mask >> lane) & 0xf;
+        if(!group) continue;
+
+        __m128 dx = _mm_load_ps(packet.d[0] + lane), dy = _mm_load_ps(packet.d[1] + lane),
+               dz = _mm_load_ps(packet.d[2] + lane);
+        __m128 sx = _mm_sub_ps(_mm_load_ps(packet.o[0] + lane), p0x);
+        __m128 sy = _mm_sub_ps(_mm_load_ps(packet.o[1] + lane), p0y);
+        __m128 sz = _mm_sub_ps(_mm_load_ps(packet.o[2] + lane), p0z);
+
+        // s1 = cross(d, e2), s2 = cross(s, e1)
+        __m128 s1x = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        __m128 s1y = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        __m128 s1z = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+        __m128 s2x = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+        __m128 s2y = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+        __m128 s2z = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+
+        auto dot = [](__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz) {
+            return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+                              _mm_mul_ps(az, bz));
+        };
+
+        __m128 det = dot(e1x, e1y, e1z, s1x, s1y, s1z);
+        __m128 inv = _mm_div_ps(one, det);
+        __m128 u = _mm_mul_ps(dot(sx, sy, sz, s1x, s1y, s1z), inv);
+        __m128 v = _mm_mul_ps(dot(dx, dy, dz, s2x, s2y, s2z), inv);
+        __m128 t = _mm_mul_ps(dot(e2x, e2y, e2z, s2x, s2y, s2z), inv);
+
+        alignas(16) float lo[4], hi[4];
+        for(size_t i = 0; i < 4; i++) {
+            lo[i] = packet.rays[lane + i].dist_bounds.x;
+            hi[i] = packet.rays[lane + i].dist_bounds.y;
+        }
+
+        // Comparisons against NaN (from det == 0) are false, so degenerate lanes drop out
+        __m128 ok = _mm_cmpneq_ps(det, zero);
+        ok = _mm_and_ps(ok, _mm_cmpge_ps(u, zero));
+        ok = _mm_and_ps(ok, _mm_cmpge_ps(v, zero));
+        ok = _mm_and_ps(ok, _mm_cmple_ps(_mm_add_ps(u, v), one));
+        ok = _mm_and_ps(ok, _mm_cmpge_ps(t, _mm_load_ps(lo)));
+        ok = _mm_and_ps(ok, _mm_cmple_ps(t, _mm_load_ps(hi)));
+
+        unsigned int m = (unsigned int)_mm_movemask_ps(ok) & group;
+        if(!m) continue;
+
+        _mm_store_ps(us + lane, u);
+        _mm_store_ps(vs + lane, v);
+        _mm_store_ps(ts + lane, t);
+        hits |= m << lane;
+    }
+#endif
+
+    for(; lane < packet.count; lane++) {
+
+        if(!(mask & (1u << lane))) continue;
+
+        const Ray& ray = packet.rays[lane];
+        Vec3 s = ray.point - p_0;
+        Vec3 s1 = cross(ray.dir, e2);
+        Vec3 s2 = cross(s, e1);
+
+        float det = dot(e1, s1);
+        if(det == 0.0f) continue;
+        float inv = 1.0f / det;
+
+        float u = dot(s, s1) * inv;
+        float v = dot(ray.dir, s2) * inv;
+        float t = dot(e2, s2) * inv;
+
+        if(u < 0.0f || v < 0.0f || u + v > 1.0f) continue;
+        if(t < ray.dist_bounds.x || t > ray.dist_bounds.y) continue;
+
+        us[lane] = u;
+        vs[lane] = v;
+        ts[lane] = t;
+        hits |= 1u << lane;
+    }
+
+    for(size_t i = 0; i < packet.count; i++) {
+
+        if(!(hits & (1u << i))) continue;
+
+        Hit& hit = ret[i];
+        hit.hit = true;
+        hit.distance = ts[i];
+        hit.primitive = idx;
+        hit.bary = Vec2(us[i], vs[i]);
+        packet.rays[i].dist_bounds.y = ts[i];
+    }
+}
+
+Triangle::Triangle(const Tri_Mesh_Data* mesh, unsigned int idx) : mesh(mesh), idx(idx) {
+}
+
+const Tri_Mesh_Vert& Triangle::vert(unsigned int i) const {
+    return mesh->verts[mesh->indices[3 * idx + i]];
+}
+
+Vec3 Triangle::normal(Vec2 bary) const {
+    float u = bary.x, v = bary.y;
+    return ((1.0f - u - v) * vert(0).normal + u * vert(1).normal + v * vert(2).normal).unit();
 }
 
 Vec3 Triangle::sample(Vec3 from) const {
-    Tri_Mesh_Vert v_0 = vertex_list[v0];
-    Tri_Mesh_Vert v_1 = vertex_list[v1];
-    Tri_Mesh_Vert v_2 = vertex_list[v2];
-    Samplers::Triangle sampler(v_0.position, v_1.position, v_2.position);
+    Samplers::Triangle sampler(vert(0).position, vert(1).position, vert(2).position);
     Vec3 pos = sampler.sample();
     return (pos - from).unit();
 }
@@ -57,12 +205,20 @@ float Triangle::pdf(Ray wray, const Mat4& T, const Mat4& iT) const {
     Ray tray = wray;
     tray.transform(iT);
 
-    Trace trace = hit(tray);
-    if(trace.hit) {
+    Hit h = hit(tray);
+    if(h.hit) {
+        Trace trace;
+        trace.origin = tray.point;
+        trace.position = tray.at(h.distance);
+        // The density is over the triangle's area, so it converts to solid angle with the
+        // geometric normal rather than the interpolated one
+        trace.normal = cross(vert(1).position - vert(0).position,
+                             vert(2).position - vert(0).position)
+                           .unit();
         trace.transform(T, iT.T());
-        Vec3 v_0 = T * vertex_list[v0].position;
-        Vec3 v_1 = T * vertex_list[v1].position;
-        Vec3 v_2 = T * vertex_list[v2].position;
+        Vec3 v_0 = T * vert(0).position;
+        Vec3 v_1 = T * vert(1).position;
+        Vec3 v_2 = T * vert(2).position;
         float a = 2.0f / cross(v_1 - v_0, v_2 - v_0).norm();
         float g =
             (trace.position - wray.point).norm_squared() / std::abs(dot(trace.normal, wray.dir));
@@ -71,72 +227,188 @@ float Triangle::pdf(Ray wray, const Mat4& T, const Mat4& iT) const {
     return 0.0f;
 }
 
-void Tri_Mesh::build(const GL::Mesh& mesh, bool bvh) {
+void Tri_Mesh::build(const GL::Mesh& mesh, bool bvh, Thread_Pool* pool) {
 
     use_bvh = bvh;
-    verts.clear();
+    data = std::make_unique<Tri_Mesh_Data>();
     triangle_bvh.clear();
     triangle_list.clear();
 
     for(const auto& v : mesh.verts()) {
-        verts.push_back({v.pos, v.norm});
+        data->verts.push_back({v.pos, v.norm});
     }
+    data->indices.assign(mesh.indices().begin(), mesh.indices().end());
+    data->precompute();
 
-    const auto& idxs = mesh.indices();
+    if(use_bvh) {
+        std::vector<Triangle> tris;
+        tris.reserve(data->triangles());
+        for(size_t i = 0; i < data->triangles(); i++) {
+            tris.push_back(Triangle(data.get(), (unsigned int)i));
+        }
 
+        BVH_Options opt;
+        opt.max_leaf_size = 4;
+        opt.pool = pool;
+        triangle_bvh.build(std::move(tris), opt);
+        reorder();
+    } else {
+        triangle_list = make_list();
+    }
+}
+
+void Tri_Mesh::reorder() {
+
+    // The BVH has sorted the triangles into leaf order; move their data to match, so that
+    // the triangles of a leaf read adjacent intersection data.
+    std::vector<Triangle>& tris = triangle_bvh.leaf_primitives();
+    std::vector<unsigned int> indices(data->indices.size());
+    for(size_t i = 0; i < tris.size(); i++) {
+        for(size_t j = 0; j < 3; j++) indices[3 * i + j] = data->indices[3 * tris[i].idx + j];
+        tris[i].idx = (unsigned int)i;
+    }
+    data->indices = std::move(indices);
+    data->precompute();
+}
+
+List<Triangle> Tri_Mesh::make_list() const {
     std::vector<Triangle> tris;
-    for(size_t i = 0; i < idxs.size(); i += 3) {
-        tris.push_back(Triangle(verts.data(), idxs[i], idxs[i + 1], idxs[i + 2]));
+    tris.reserve(data->triangles());
+    for(size_t i = 0; i < data->triangles(); i++) {
+        tris.push_back(Triangle(data.get(), (unsigned int)i));
     }
+    return List<Triangle>(std::move(tris));
+}
 
-    if(use_bvh) {
-        triangle_bvh.build(std::move(tris), 4);
-    } else {
-        triangle_list = List<Triangle>(std::move(tris));
+bool Tri_Mesh::refit(const GL::Mesh& mesh, Thread_Pool* pool) {
+
+    if(!data || mesh.verts().size() != data->verts.size()) return false;
+
+    for(size_t i = 0; i < data->verts.size(); i++) {
+        data->verts[i] = {mesh.verts()[i].pos, mesh.verts()[i].norm};
     }
+    data->precompute();
+
+    // If the refit degraded the tree too much, the BVH was rebuilt and reordered its leaves
+    if(use_bvh && !triangle_bvh.refit(pool)) reorder();
+    return true;
 }
 
-Tri_Mesh::Tri_Mesh(const GL::Mesh& mesh, bool use_bvh) {
-    build(mesh, use_bvh);
+Tri_Mesh::Tri_Mesh(const GL::Mesh& mesh, bool use_bvh, Thread_Pool* pool) {
+    build(mesh, use_bvh, pool);
 }
 
 Tri_Mesh Tri_Mesh::copy() const {
     Tri_Mesh ret;
-    ret.verts = verts;
-    ret.triangle_bvh = triangle_bvh.copy();
-    ret.triangle_list = triangle_list.copy();
     ret.use_bvh = use_bvh;
+    if(!data) return ret;
+
+    // The copied triangles must point at the copied data
+    ret.data = std::make_unique<Tri_Mesh_Data>(*data);
+    if(use_bvh) {
+        ret.triangle_bvh = triangle_bvh.copy();
+        for(Triangle& tri : ret.triangle_bvh.leaf_primitives()) tri.mesh = ret.data.get();
+    } else {
+        ret.triangle_list = ret.make_list();
+    }
     return ret;
 }
 
+const BVH_Stats& Tri_Mesh::bvh_stats() const {
+    return triangle_bvh.stats();
+}
+
 BBox Tri_Mesh::bbox() const {
     if(use_bvh) return triangle_bvh.bbox();
     return triangle_list.bbox();
 }
 
-Trace Tri_Mesh::hit(const Ray& ray) const {
+Hit Tri_Mesh::hit(const Ray& ray) const {
     if(use_bvh) return triangle_bvh.hit(ray);
     return triangle_list.hit(ray);
 }
 
+void Tri_Mesh::hit(const Ray_Packet& packet, unsigned int mask, Hit* ret) const {
+    if(use_bvh) {
+        triangle_bvh.hit(packet, mask, ret);
+    } else {
+        triangle_list.hit(packet, mask, ret);
+    }
+}
+
+bool Tri_Mesh::occluded(const Ray& ray) const {
+    if(use_bvh) return triangle_bvh.occluded(ray);
+    return triangle_list.occluded(ray);
+}
+
+Trace Tri_Mesh::finalize(const Ray& ray, const Hit& hit) const {
+    Trace ret;
+    ret.origin = ray.point;
+    if(!hit.hit) return ret;
+    ret.hit = true;
+    ret.distance = hit.distance;
+    ret.position = ray.at(hit.distance);
+    ret.normal = Triangle(data.get(), hit.primitive).normal(hit.bary);
+    ret.material = hit.material;
+    return ret;
+}
+
 size_t Tri_Mesh::visualize(GL::Lines& lines, GL::Lines& active, size_t level,
                            const Mat4& trans) const {
     if(use_bvh) return triangle_bvh.visualize(lines, active, level, trans);
     return 0;
 }
 
-Vec3 Tri_Mesh::sample(Vec3 from) const {
-    if(use_bvh) {
-        die("Sampling BVH-based triangle meshes is not yet supported.");
+void Tri_Mesh::prepare_sampling() {
+
+    if(!data || data->areas.size() == data->triangles()) return;
+
+    size_t n = data->triangles();
+    std::vector<float> area(n);
+    data->area = 0.0f;
+    for(size_t i = 0; i < n; i++) {
+        Vec3 v_0 = data->verts[data->indices[3 * i]].position;
+        Vec3 v_1 = data->verts[data->indices[3 * i + 1]].position;
+        Vec3 v_2 = data->verts[data->indices[3 * i + 2]].position;
+        area[i] = 0.5f * cross(v_1 - v_0, v_2 - v_0).norm();
+        data->area += area[i];
     }
-    return triangle_list.sample(from);
+    data->areas = Samplers::Alias_Table(area.data(), n);
+}
+
+float Tri_Mesh::area() const {
+    return data ? data->area : 0.0f;
+}
+
+Vec3 Tri_Mesh::sample(Vec3 from) const {
+    if(!data || !data->areas.size()) return {};
+    float rest;
+    size_t idx = data->areas.sample(RNG::unit(), rest);
+    return Triangle(data.get(), (unsigned int)idx).sample(from);
 }
 
 float Tri_Mesh::pdf(Ray ray, const Mat4& T, const Mat4& iT) const {
+
+    if(!data || !data->areas.size()) return 0.0f;
+
+    // Every triangle the ray passes through could have produced it. Triangle::pdf is the
+    // density given that triangle was chosen, so weight it by the triangle's probability.
+    // Degenerate triangles are never chosen, and their density would be infinite.
+    float ret = 0.0f;
+    auto add = [&](const Triangle& tri) {
+        float p = data->areas.probability(tri.idx);
+        if(p > 0.0f) ret += p * tri.pdf(ray, T, iT);
+    };
+
     if(use_bvh) {
-        die("Sampling BVH-based triangle meshes is not yet supported.");
+        // The BVH only rejects triangles whose boxes the ray misses, in mesh space
+        Ray local = ray;
+        local.transform(iT);
+        triangle_bvh.visit(local, add);
+    } else {
+        for(size_t i = 0; i < data->triangles(); i++) add(Triangle(data.get(), (unsigned int)i));
     }
-    return triangle_list.pdf(ray, T, iT);
+    return ret;
 }
 
 } // namespace PT
@@ -0,0 +1,64 @@
+
+#include "frame_writer.h"
+
+#include <sf_libs/stb_image_write.h>
+
+Frame_Writer::Frame_Writer(float exposure, size_t max_pending)
+    : exposure(exposure), max_pending(max_pending), thread([this]() { run(); }) {
+}
+
+Frame_Writer::~Frame_Writer() {
+    finish();
+}
+
+std::string Frame_Writer::push(HDR_Image image, std::string path) {
+    std::unique_lock<std::mutex> lock(mut);
+    cv.wait(lock, [this]() { return queue.size() < max_pending || !error.empty(); });
+    if(!error.empty()) return error;
+    queue.push_back({std::move(image), std::move(path)});
+    cv.notify_all();
+    return {};
+}
+
+std::string Frame_Writer::finish() {
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        done = true;
+        cv.notify_all();
+    }
+    if(thread.joinable()) thread.join();
+    return error;
+}
+
+void Frame_Writer::run() {
+    while(true) {
+        Frame frame;
+        {
+            std::unique_lock<std::mutex> lock(mut);
+            cv.wait(lock, [this]() { return !queue.empty() || done; });
+            if(queue.empty()) return;
+            frame = std::move(queue.front());
+            queue.pop_front();
+            cv.notify_all();
+        }
+        std::string err = write(frame);
+        if(!err.empty()) {
+            std::lock_guard<std::mutex> lock(mut);
+            if(error.empty()) error = err;
+            cv.notify_all();
+        }
+    }
+}
+
+std::string Frame_Writer::write(const Frame& frame) const {
+    if(HDR_Image::can_save(frame.path)) return frame.image.save_to(frame.path);
+
+    auto [w, h] = frame.image.dimension();
+    std::vector<unsigned char> data;
+    frame.image.tonemap_to(data, exposure);
+    stbi_flip_vertically_on_write(false);
+    if(!stbi_write_png(frame.path.c_str(), (int)w, (int)h, 4, data.data(), (int)w * 4)) {
+        return "Failed to write " + frame.path + "!";
+    }
+    return {};
+}
@@ -0,0 +1,45 @@
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "hdr_image.h"
+
+// Writes finished frames on a background thread, so the next frame can start tracing
+// while the last one is encoded. Frames go to .exr and .pfm files as linear radiance and
+// to anything else as tonemapped PNG. At most max_pending frames wait in memory.
+class Frame_Writer {
+public:
+    Frame_Writer(float exposure, size_t max_pending);
+    ~Frame_Writer();
+
+    /// Queue a frame, waiting while max_pending frames are already queued. Returns the
+    /// error of any earlier frame that failed to write.
+    std::string push(HDR_Image image, std::string path);
+
+    /// Write every queued frame and stop
+    std::string finish();
+
+private:
+    struct Frame {
+        HDR_Image image;
+        std::string path;
+    };
+
+    void run();
+    std::string write(const Frame& frame) const;
+
+    float exposure;
+    size_t max_pending;
+
+    std::mutex mut;
+    std::condition_variable cv;
+    std::deque<Frame> queue;
+    bool done = false;
+    std::string error;
+    std::thread thread;
+};
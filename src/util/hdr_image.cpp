@@ -1,7 +1,12 @@
 
 #include "hdr_image.h"
 #include "../lib/log.h"
+#include "thread_pool.h"
 
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
 #include <sf_libs/stb_image.h>
 #include <sf_libs/tinyexr.h>
 
@@ -16,7 +21,7 @@ HDR_Image::HDR_Image(size_t w, size_t h) : w(w), h(h) {
 HDR_Image HDR_Image::copy() const {
     HDR_Image ret;
     ret.resize(w, h);
-    ret.pixels.insert(ret.pixels.begin(), pixels.begin(), pixels.end());
+    ret.pixels = pixels;
     ret.last_path = last_path;
     ret.dirty = true;
     ret.exposure = exposure;
@@ -40,6 +45,15 @@ void HDR_Image::clear(Spectrum color) {
     dirty = true;
 }
 
+void HDR_Image::clear(Spectrum color, Rect rect) {
+    rect.x1 = std::min(rect.x1, w);
+    rect.y1 = std::min(rect.y1, h);
+    for(size_t y = rect.y0; y < rect.y1; y++) {
+        std::fill(pixels.begin() + y * w + rect.x0, pixels.begin() + y * w + rect.x1, color);
+    }
+    mark_dirty(rect);
+}
+
 Spectrum& HDR_Image::at(size_t i) {
     assert(i < w * h);
     dirty = true;
@@ -64,6 +78,27 @@ Spectrum HDR_Image::at(size_t x, size_t y) const {
     return pixels[idx];
 }
 
+Spectrum* HDR_Image::row(size_t y) {
+    assert(y < h);
+    return pixels.data() + y * w;
+}
+
+const Spectrum* HDR_Image::row(size_t y) const {
+    assert(y < h);
+    return pixels.data() + y * w;
+}
+
+void HDR_Image::mark_dirty() {
+    dirty = true;
+}
+
+void HDR_Image::mark_dirty(Rect rect) {
+    rect.x1 = std::min(rect.x1, w);
+    rect.y1 = std::min(rect.y1, h);
+    if(dirty || rect.x0 >= rect.x1 || rect.y0 >= rect.y1) return;
+    dirty_rects.push_back(rect);
+}
+
 std::string HDR_Image::load_from(std::string file) {
 
     if(IsEXR(file.c_str()) == TINYEXR_SUCCESS) {
@@ -135,7 +170,111 @@ std::string HDR_Image::loaded_from() const {
     return last_path;
 }
 
-void HDR_Image::tonemap(float e) const {
+static bool has_extension(const std::string& file, const char* ext) {
+    size_t n = std::strlen(ext);
+    if(file.size() < n) return false;
+    for(size_t i = 0; i < n; i++) {
+        if(std::tolower((unsigned char)file[file.size() - n + i]) != ext[i]) return false;
+    }
+    return true;
+}
+
+bool HDR_Image::can_save(std::string file) {
+    return has_extension(file, ".exr") || has_extension(file, ".pfm");
+}
+
+std::string HDR_Image::save_to(std::string file) const {
+
+    if(has_extension(file, ".exr")) {
+
+        // EXR scanlines go top to bottom
+        std::vector<float> data(w * h * 3);
+        for(size_t j = 0; j < h; j++) {
+            const Spectrum* src = row(h - j - 1);
+            for(size_t i = 0; i < w; i++) {
+                data[3 * (j * w + i)] = src[i].r;
+                data[3 * (j * w + i) + 1] = src[i].g;
+                data[3 * (j * w + i) + 2] = src[i].b;
+            }
+        }
+
+        const char* err = nullptr;
+        int ret = SaveEXR(data.data(), (int)w, (int)h, 3, 0, file.c_str(), &err);
+        if(ret != TINYEXR_SUCCESS) {
+            if(err) {
+                std::string err_s(err);
+                FreeEXRErrorMessage(err);
+                return err_s;
+            } else
+                return "Unknown failure.";
+        }
+
+    } else if(has_extension(file, ".pfm")) {
+
+        // PFM scanlines go bottom to top, like ours. A negative scale marks little-endian.
+        const uint16_t one = 1;
+        bool little = *(const unsigned char*)&one == 1;
+
+        std::ofstream out(file, std::ios::binary);
+        if(!out) return "Failed to open " + file + " for writing.";
+        out << "PF\n" << w << " " << h << "\n" << (little ? "-1.0" : "1.0") << "\n";
+        for(size_t j = 0; j < h; j++) {
+            const Spectrum* src = row(j);
+            for(size_t i = 0; i < w; i++) {
+                float rgb[3] = {src[i].r, src[i].g, src[i].b};
+                out.write((const char*)rgb, sizeof(rgb));
+            }
+        }
+        if(!out) return "Failed to write " + file + ".";
+
+    } else {
+        return "Unsupported format: expected a .exr or .pfm file.";
+    }
+
+    return {};
+}
+
+// Each channel is tonemapped to round(255 * srgb(1 - exp(-exposure * x))), which never
+// decreases as x grows. So instead of evaluating an exp and a pow per channel, find the
+// radiance at which each byte value begins once per exposure, and binary search those.
+struct Tonemap_Curve {
+
+    explicit Tonemap_Curve(float exposure) {
+        start[0] = -FLT_MAX;
+        for(int k = 1; k < 256; k++) {
+            float v = Spectrum::to_linear((k - 0.5f) / 255.0f);
+            start[k] = -std::log1p(-v) / exposure;
+        }
+    }
+
+    // Comparisons against NaN fail, so invalid radiance maps to 0
+    unsigned char operator()(float x) const {
+        unsigned int b = 0;
+        for(unsigned int step = 128; step > 0; step >>= 1) {
+            if(x >= start[b + step]) b += step;
+        }
+        return (unsigned char)b;
+    }
+
+    float start[256];
+};
+
+static void tonemap_rect(const Spectrum* pixels, size_t w, size_t h, unsigned char* data,
+                         const Tonemap_Curve& curve, HDR_Image::Rect rect) {
+    for(size_t y = rect.y0; y < rect.y1; y++) {
+        const Spectrum* src = pixels + y * w;
+        unsigned char* dst = data + 4 * (h - y - 1) * w;
+        for(size_t x = rect.x0; x < rect.x1; x++) {
+            dst[4 * x] = curve(src[x].r);
+            dst[4 * x + 1] = curve(src[x].g);
+            dst[4 * x + 2] = curve(src[x].b);
+            dst[4 * x + 3] = 255;
+        }
+    }
+}
+
+#ifndef SCOTTY3D_HEADLESS
+void HDR_Image::tonemap(float e, Thread_Pool* pool) const {
 
     if(e <= 0.0f) {
         e = exposure;
@@ -144,21 +283,33 @@ void HDR_Image::tonemap(float e) const {
         dirty = true;
     }
 
-    if(!dirty) return;
-
-    std::vector<unsigned char> data;
-    tonemap_to(data, e);
-    render_tex.image((int)w, (int)h, data.data());
+    if(tonemapped.size() != w * h * 4) dirty = true;
+
+    if(dirty) {
+        tonemap_to(tonemapped, e, pool);
+        render_tex.image((int)w, (int)h, tonemapped.data());
+    } else if(!dirty_rects.empty()) {
+        // Progressive renders update a few tiles at a time
+        Tonemap_Curve curve(e);
+        for(const Rect& r : dirty_rects) {
+            tonemap_rect(pixels.data(), w, h, tonemapped.data(), curve, r);
+            size_t row = h - r.y1;
+            render_tex.update((int)r.x0, (int)row, (int)(r.x1 - r.x0), (int)(r.y1 - r.y0),
+                              (int)w, tonemapped.data() + 4 * (row * w + r.x0));
+        }
+    }
 
     dirty = false;
+    dirty_rects.clear();
 }
 
-const GL::Tex2D& HDR_Image::get_texture(float e) const {
-    tonemap(e);
+const GL::Tex2D& HDR_Image::get_texture(float e, Thread_Pool* pool) const {
+    tonemap(e, pool);
     return render_tex;
 }
+#endif
 
-void HDR_Image::tonemap_to(std::vector<unsigned char>& data, float e) const {
+void HDR_Image::tonemap_to(std::vector<unsigned char>& data, float e, Thread_Pool* pool) const {
 
     if(e <= 0.0f) {
         e = exposure;
@@ -166,24 +317,19 @@ void HDR_Image::tonemap_to(std::vector<unsigned char>& data, float e) const {
 
     if(data.size() != w * h * 4) data.resize(w * h * 4);
 
-    for(size_t j = 0; j < h; j++) {
-        for(size_t i = 0; i < w; i++) {
-
-            size_t pidx = (h - j - 1) * w + i;
-            const Spectrum& sample = pixels[pidx];
-
-            float r = 1.0f - std::exp(-sample.r * exposure);
-            float g = 1.0f - std::exp(-sample.g * exposure);
-            float b = 1.0f - std::exp(-sample.b * exposure);
-
-            Spectrum out(r, g, b);
-            out = out.to_srgb();
+    Tonemap_Curve curve(e);
+    constexpr size_t chunk_rows = 32;
+    if(!pool || h <= chunk_rows) {
+        tonemap_rect(pixels.data(), w, h, data.data(), curve, {0, 0, w, h});
+        return;
+    }
 
-            size_t didx = 4 * (j * w + i);
-            data[didx] = (unsigned char)std::round(out.r * 255.0f);
-            data[didx + 1] = (unsigned char)std::round(out.g * 255.0f);
-            data[didx + 2] = (unsigned char)std::round(out.b * 255.0f);
-            data[didx + 3] = 255;
-        }
+    std::vector<std::future<void>> chunks;
+    for(size_t y = 0; y < h; y += chunk_rows) {
+        Rect rect = {0, y, w, std::min(y + chunk_rows, h)};
+        chunks.push_back(pool->enqueue([this, &data, &curve, rect]() {
+            tonemap_rect(pixels.data(), w, h, data.data(), curve, rect);
+        }));
     }
+    for(auto& chunk : chunks) pool->wait_on(chunk);
 }
@@ -6,8 +6,15 @@
 #include "../lib/spectrum.h"
 #include "../platform/gl.h"
 
+class Thread_Pool;
+
 class HDR_Image {
 public:
+    /// The region [x0,x1) x [y0,y1) of the image
+    struct Rect {
+        size_t x0, y0, x1, y1;
+    };
+
     HDR_Image();
     HDR_Image(size_t w, size_t h);
     HDR_Image(const HDR_Image& src) = delete;
@@ -24,24 +31,51 @@ public:
     Spectrum& at(size_t i);
     Spectrum at(size_t i) const;
 
+    // Unlike at(), these do not mark the image dirty, so disjoint rows may be
+    // written concurrently; call mark_dirty() once the writes are visible.
+    Spectrum* row(size_t y);
+    const Spectrum* row(size_t y) const;
+    void mark_dirty();
+    /// Only the pixels in rect changed, so the texture only needs that region tonemapped
+    /// and uploaded again
+    void mark_dirty(Rect rect);
+
     void clear(Spectrum color);
+    /// Only set the pixels in rect
+    void clear(Spectrum color, Rect rect);
     void resize(size_t w, size_t h);
     std::pair<size_t, size_t> dimension() const;
 
     std::string load_from(std::string file);
     std::string loaded_from() const;
+    /// Write the linear radiance to an OpenEXR (.exr) or portable float map (.pfm) file
+    std::string save_to(std::string file) const;
+    /// Whether save_to supports the format of this file name
+    static bool can_save(std::string file);
 
-    void tonemap_to(std::vector<unsigned char>& data, float exposure = 0.0f) const;
-    const GL::Tex2D& get_texture(float exposure = 0.0f) const;
+    /// Tonemap to RGBA8, top row first. Rows are split across the pool if one is given.
+    void tonemap_to(std::vector<unsigned char>& data, float exposure = 0.0f,
+                    Thread_Pool* pool = nullptr) const;
+#ifndef SCOTTY3D_HEADLESS
+    const GL::Tex2D& get_texture(float exposure = 0.0f, Thread_Pool* pool = nullptr) const;
+#endif
 
 private:
-    void tonemap(float exposure = 0.0f) const;
+#ifndef SCOTTY3D_HEADLESS
+    void tonemap(float exposure, Thread_Pool* pool) const;
+#endif
 
     size_t w, h;
     std::string last_path;
     std::vector<Spectrum> pixels;
 
+#ifndef SCOTTY3D_HEADLESS
     mutable GL::Tex2D render_tex;
+#endif
     mutable float exposure = 1.0f;
+    // dirty means the whole texture is out of date; otherwise only dirty_rects are
     mutable bool dirty = true;
+    mutable std::vector<Rect> dirty_rects;
+    // The texture's contents, which regions are tonemapped into before uploading them
+    mutable std::vector<unsigned char> tonemapped;
 };
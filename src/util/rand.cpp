@@ -8,16 +8,83 @@
 
 namespace RNG {
 
-static thread_local std::mt19937 rng;
+static thread_local PCG32 rng;
+static thread_local uint64_t sample_key = 0;
+
+// Sobol points are scrambled per pixel rather than per sample, so that the pixel's
+// samples together form one stratified sequence
+static thread_local Sequence sequence = Sequence::independent;
+static thread_local uint64_t pixel_key = 0;
+static thread_local uint32_t sample_index = 0, dimension = 0, vertex = 0;
+
+// SplitMix64 finalizer: spreads nearby inputs (neighbouring pixels and sample indices)
+// over unrelated seeds
+static uint64_t mix(uint64_t h) {
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+static uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// Hash-based Owen scrambling of a 32-bit fraction (Burley, "Practical Hash-based Owen
+// Scrambling", JCGT 2020): each bit is flipped depending only on the bits above it.
+static uint32_t owen_scramble(uint32_t x, uint32_t seed) {
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverse_bits(x);
+}
+
+// First two dimensions of the Sobol sequence, as 32-bit fractions
+static uint32_t sobol_0(uint32_t i) {
+    return reverse_bits(i);
+}
+static uint32_t sobol_1(uint32_t i) {
+    uint32_t r = 0;
+    for(uint32_t v = 1u << 31; i; i >>= 1, v ^= v >> 1) {
+        if(i & 1) r ^= v;
+    }
+    return r;
+}
+
+static float to_unit(uint32_t x) {
+    return (float)(x >> 8) * (1.0f / 16777216.0f);
+}
 
 float unit() {
-    std::uniform_real_distribution<float> d(0.0f, 1.0f);
-    return d(rng);
+    return rng.unit();
+}
+
+Vec2 unit2() {
+    if(sequence == Sequence::independent) {
+        float x = rng.unit();
+        return Vec2(x, rng.unit());
+    }
+
+    // Padded 2D sampling: the sample index is shuffled (by scrambling it) differently
+    // for every pair of dimensions, which decorrelates the pairs from each other while
+    // each pair keeps its stratification over the pixel's samples.
+    uint64_t h = mix(pixel_key ^ ((uint64_t)vertex << 32 | dimension++));
+    uint32_t i = owen_scramble(sample_index, (uint32_t)h);
+    uint32_t x = owen_scramble(sobol_0(i), (uint32_t)(h >> 32));
+    uint32_t y = owen_scramble(sobol_1(i), (uint32_t)mix(h));
+    return Vec2(to_unit(x), to_unit(y));
 }
 
 int integer(int min, int max) {
-    std::uniform_int_distribution<int> d(min, max - 1);
-    return d(rng);
+    uint64_t range = (uint64_t)(max - min);
+    return min + (int)(((uint64_t)rng.next() * range) >> 32);
 }
 
 bool coin_flip(float p) {
@@ -30,7 +97,24 @@ void seed() {
         r() ^
         (std::random_device::result_type)std::hash<std::thread::id>()(std::this_thread::get_id()) ^
         (std::random_device::result_type)std::hash<time_t>()(std::time(nullptr));
-    rng.seed(seed);
+    sample_key = mix(seed);
+    rng.seed(sample_key);
+    sequence = Sequence::independent;
+}
+
+void seed(uint32_t seed, uint32_t pixel, uint32_t sample, Sequence seq) {
+    sample_key = mix(mix(seed) ^ (((uint64_t)pixel << 32) | sample));
+    rng.seed(sample_key);
+    sequence = seq;
+    pixel_key = mix(mix(seed) + pixel);
+    sample_index = sample;
+    dimension = vertex = 0;
+}
+
+void bounce(uint32_t v) {
+    rng.seed(sample_key, v);
+    dimension = 0;
+    vertex = v;
 }
 
 } // namespace RNG
@@ -3,11 +3,54 @@
 
 #include "../lib/mathlib.h"
 
+#include <cstdint>
+
 namespace RNG {
 
+// PCG32 (O'Neill, "PCG: A Family of Simple Fast Space-Efficient Statistically Good
+// Algorithms for Random Number Generation"): 16 bytes of state and one 64-bit
+// multiply-add per number. Each stream is an independent sequence for the same seed.
+class PCG32 {
+public:
+    PCG32() = default;
+    PCG32(uint64_t seed, uint64_t stream = 0) {
+        this->seed(seed, stream);
+    }
+
+    void seed(uint64_t seed, uint64_t stream = 0) {
+        state = 0;
+        inc = (stream << 1u) | 1u;
+        next();
+        state += seed;
+        next();
+    }
+
+    uint32_t next() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ull + inc;
+        uint32_t shifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+        uint32_t rot = (uint32_t)(old >> 59u);
+        return (shifted >> rot) | (shifted << ((32u - rot) & 31u));
+    }
+
+    // Random float in the range [0,1)
+    float unit() {
+        return (float)(next() >> 8) * (1.0f / 16777216.0f);
+    }
+
+private:
+    uint64_t state = 0x853c49e6748fea9bull;
+    uint64_t inc = 0xda3e39cb94b95bdbull;
+};
+
 // Generate random float in the range [0,1]
 float unit();
 
+// Generate a random point in [0,1]^2. While tracing a sample seeded with Sequence::sobol,
+// successive calls return the successive dimensions of a low-discrepancy sequence over
+// the pixel's samples, so use this for each 2D decision (e.g. a direction or a point).
+Vec2 unit2();
+
 // Generate random integer in the range [min,max)
 int integer(int min, int max);
 
@@ -16,4 +59,22 @@ bool coin_flip(float p = 0.5f);
 
 // Seed the current thread's PRNG
 void seed();
+
+// Sequences unit2() can draw from while tracing a pixel's samples
+enum class Sequence : uint8_t {
+    // Independent random numbers
+    independent,
+    // Owen-scrambled Sobol points: each pair of dimensions is a (0,2)-sequence over the
+    // pixel's sample indices, scrambled and shuffled independently per pixel and dimension
+    sobol
+};
+
+// Seed the current thread's PRNG deterministically for one sample of one pixel, so that
+// the sample comes out the same no matter which thread traces it or in what order
+void seed(uint32_t seed, uint32_t pixel, uint32_t sample,
+          Sequence sequence = Sequence::independent);
+
+// Switch to the random sequence of a vertex along the current sample's path. Vertices
+// then don't depend on how many numbers were drawn at earlier ones.
+void bounce(uint32_t vertex);
 } // namespace RNG
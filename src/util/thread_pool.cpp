@@ -34,8 +34,11 @@ void Thread_Pool::start(size_t threads) {
 }
 
 void Thread_Pool::clear() {
-    stop();
-    start(n_threads);
+    std::queue<std::function<void()>> dropped;
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        std::swap(tasks, dropped);
+    }
 }
 
 void Thread_Pool::wait() {
@@ -54,6 +57,11 @@ void Thread_Pool::wait() {
     start(n_threads);
 }
 
+void Thread_Pool::resize(size_t threads) {
+    stop();
+    start(threads);
+}
+
 void Thread_Pool::stop() {
 
     {
@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <condition_variable>
 #include <functional>
 #include <future>
@@ -17,7 +18,16 @@ public:
 
     void stop();
     void wait();
+    /// Drop every task that hasn't started. Running tasks continue, and the threads stay
+    /// alive, so the pool can take new tasks immediately. Futures of dropped tasks become
+    /// ready with a broken_promise error.
     void clear();
+    /// Drop any queued tasks and restart with a different number of threads
+    void resize(size_t threads);
+    /// Number of worker threads
+    size_t size() const {
+        return n_threads;
+    }
 
     template<class F, class... Args>
     auto enqueue(F&& f, Args&&... args)
@@ -38,6 +48,28 @@ public:
         return res;
     }
 
+    // Block until fut is ready, running queued tasks on the calling thread in the
+    // meantime. This lets a task wait on subtasks enqueued to the same pool without
+    // deadlocking when every worker is busy waiting.
+    template<typename T> T wait_on(std::future<T>& fut) {
+        while(fut.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                if(!tasks.empty()) {
+                    task = std::move(tasks.front());
+                    tasks.pop();
+                }
+            }
+            if(task) {
+                task();
+            } else {
+                fut.wait_for(std::chrono::microseconds(100));
+            }
+        }
+        return fut.get();
+    }
+
 private:
     void start(size_t);
     size_t n_threads;